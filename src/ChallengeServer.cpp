@@ -0,0 +1,527 @@
+//============================================================================
+// Name        : ChallengeServer.cpp
+// Author      : Jan Gutter
+// Copyright   : To the extent possible under law, Jan Gutter has waived all
+//             : copyright and related or neighboring rights to this work.
+//             : For more information, go to:
+//             : http://creativecommons.org/publicdomain/zero/1.0/
+//             : or consult the README and COPYING files
+// Description : Local stand-in for the contest's ChallengeService
+//============================================================================
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <soap/nsmap.h>
+#include "sleep.h"
+#include "ChallengeServer.h"
+#include "MCTree.h"
+
+#define SERVE_ACCEPT_TIMEOUT 1 //s, how often a port checks whether the game's done
+#define SERVE_LINGER_TICKS 2 //Ticks of "Game over" before the server goes away
+
+static const char* player_name[2] = {"Player One", "Player Two"};
+
+static int ntoh_cmd(const enum ns1__action* action)
+{
+	if (!action) {
+		return C_NONE;
+	}
+	switch (*action) {
+	default:
+	case ns1__action__NONE:
+		return C_NONE;
+	case ns1__action__UP:
+		return C_UP;
+	case ns1__action__DOWN:
+		return C_DOWN;
+	case ns1__action__LEFT:
+		return C_LEFT;
+	case ns1__action__RIGHT:
+		return C_RIGHT;
+	case ns1__action__FIRE:
+		return C_FIRE;
+	}
+}
+
+static enum ns1__direction* hton_direction(struct soap* soap, const int o)
+{
+	enum ns1__direction* direction = (enum ns1__direction*)soap_malloc(soap, sizeof(enum ns1__direction));
+	switch (o) {
+	default:
+	case O_UP:
+		*direction = ns1__direction__UP;
+		break;
+	case O_DOWN:
+		*direction = ns1__direction__DOWN;
+		break;
+	case O_LEFT:
+		*direction = ns1__direction__LEFT;
+		break;
+	case O_RIGHT:
+		*direction = ns1__direction__RIGHT;
+		break;
+	}
+	return direction;
+}
+
+//What soapServer.cpp would do with a response, had it been generated
+template <class T> static int sendResponse(struct soap* soap, T& response, const char* tag)
+{
+	soap->encodingStyle = NULL;
+	soap_serializeheader(soap);
+	response.soap_serialize(soap);
+	if (soap_begin_count(soap)) {
+		return soap->error;
+	}
+	if (soap->mode & SOAP_IO_LENGTH) {
+		if (soap_envelope_begin_out(soap)
+				|| soap_putheader(soap)
+				|| soap_body_begin_out(soap)
+				|| response.soap_put(soap, tag, "")
+				|| soap_body_end_out(soap)
+				|| soap_envelope_end_out(soap)) {
+			return soap->error;
+		}
+	}
+	if (soap_end_count(soap)
+			|| soap_response(soap, SOAP_OK)
+			|| soap_envelope_begin_out(soap)
+			|| soap_putheader(soap)
+			|| soap_body_begin_out(soap)
+			|| response.soap_put(soap, tag, "")
+			|| soap_body_end_out(soap)
+			|| soap_envelope_end_out(soap)
+			|| soap_end_send(soap)) {
+		return soap->error;
+	}
+	return soap_closesock(soap);
+}
+
+static int endRequest(struct soap* soap)
+{
+	if (soap_body_end_in(soap)
+			|| soap_envelope_end_in(soap)
+			|| soap_end_recv(soap)) {
+		return soap->error;
+	}
+	return SOAP_OK;
+}
+
+ChallengeServer::ChallengeServer(const char* map_file, const int port)
+{
+	int i;
+	ifstream fin(map_file);
+	state = new PlayoutState;
+	fin >> *state;
+	fin.close();
+	state->endgame_tick = 200;
+	state->gameover = false;
+	state->stop_playout = false;
+	started = false;
+	over = false;
+	finished = false;
+	for (i = 0; i < 4; i++) {
+		pending[i] = C_NONE;
+	}
+	for (i = 0; i < 2; i++) {
+		acted_tick[i] = -1;
+		num_acted[i] = 0;
+		num_calls[i] = 0;
+		endpoint[i].server = this;
+		endpoint[i].player = i;
+		endpoint[i].port = port+i;
+		endpoint[i].sfmt = new_sfmt();
+		sfmt_init_gen_rand(endpoint[i].sfmt, (uint32_t)(port+i));
+	}
+	next_bullet_id = 2001;
+	tick_ms = 2000;
+	delay_ms = 0;
+	jitter_ms = 0;
+	max_ticks = 300;
+}
+
+ChallengeServer::~ChallengeServer()
+{
+	int i;
+	for (i = 0; i < 2; i++) {
+		delete_sfmt(endpoint[i].sfmt);
+	}
+	delete state;
+}
+
+double ChallengeServer::elapsedMs()
+{
+	clock.stop();
+	return (double)clock.get_microseconds()/1000.0;
+}
+
+//Under game_mutex, with the game started
+double ChallengeServer::msToNextTick()
+{
+	return (double)(state->tickno+1)*tick_ms - elapsedMs();
+}
+
+//Under game_mutex: plays the tick out on whatever commands came in
+void ChallengeServer::tick()
+{
+	vector<unsigned char> walls(state->max_x*state->max_y);
+	bool fired[4];
+	int i,x,y;
+	for (x = 0; x < state->max_x; x++) {
+		for (y = 0; y < state->max_y; y++) {
+			walls[x*state->max_y+y] = state->board[x][y] & B_WALL;
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		state->command[i] = state->tank[i].active ? pending[i] : C_NONE;
+		pending[i] = C_NONE;
+		fired[i] = !state->bullet[i].active;
+	}
+	state->simulateTick();
+	for (i = 0; i < 4; i++) {
+		if (fired[i] && state->bullet[i].active) {
+			state->bullet[i].id = next_bullet_id++;
+		}
+	}
+	destroyed.clear();
+	for (x = 0; x < state->max_x; x++) {
+		for (y = 0; y < state->max_y; y++) {
+			if (walls[x*state->max_y+y] && !(state->board[x][y] & B_WALL)) {
+				destroyed.push_back(make_pair(x,y));
+			}
+		}
+	}
+	if (state->gameover || state->tickno >= max_ticks) {
+		over = true;
+	}
+}
+
+void ChallengeServer::run()
+{
+	tthread::thread* port_thread[2];
+	bool ready = false;
+	double wait;
+	int i,ticks;
+	for (i = 0; i < 2; i++) {
+		port_thread[i] = new tthread::thread(portThread, &endpoint[i]);
+	}
+	cout << "Serving " << player_name[0] << " on port " << endpoint[0].port << ", " << player_name[1] << " on "
+			<< endpoint[1].port << ": " << tick_ms << " ms ticks, " << delay_ms << " ms delay, "
+			<< jitter_ms << " ms jitter" << endl;
+	while (!ready) {
+		Sleep(10);
+		game_mutex.lock();
+		ready = started;
+		game_mutex.unlock();
+	}
+	ticks = 0;
+	while (ticks < SERVE_LINGER_TICKS) {
+		game_mutex.lock();
+		wait = msToNextTick();
+		game_mutex.unlock();
+		if (wait > 0) {
+			Sleep((uint32_t)wait);
+		}
+		game_mutex.lock();
+		if (!over) {
+			tick();
+		} else {
+			state->tickno++;
+			ticks++;
+		}
+		game_mutex.unlock();
+	}
+	game_mutex.lock();
+	finished = true;
+	game_mutex.unlock();
+	for (i = 0; i < 2; i++) {
+		port_thread[i]->join();
+		delete port_thread[i];
+	}
+	ticks = state->tickno-SERVE_LINGER_TICKS;
+	cout << "Game over after " << ticks << " ticks";
+	if (state->gameover) {
+		cout << ", winner " << state->winner;
+	}
+	cout << endl;
+	for (i = 0; i < 2; i++) {
+		cout << player_name[i] << ": actions on " << num_acted[i] << "/" << ticks << " ticks, "
+				<< num_calls[i] << " calls" << endl;
+	}
+}
+
+void ChallengeServer::portThread(void* param)
+{
+	ServerPort* endpoint = (ServerPort*)param;
+	endpoint->server->serve(*endpoint);
+}
+
+//One connection at a time, kept alive for as long as the client wants;
+//NetworkCore only ever has the one
+void ChallengeServer::serve(ServerPort& endpoint)
+{
+	struct soap* soap = soap_new1(SOAP_IO_KEEPALIVE);
+	bool done = false;
+	soap_set_namespaces(soap, namespaces);
+	soap->bind_flags = SO_REUSEADDR;
+	soap->accept_timeout = SERVE_ACCEPT_TIMEOUT;
+	//An idle kept-alive connection waits out a tick between calls
+	soap->recv_timeout = max(5, 4*tick_ms/1000);
+	soap->send_timeout = soap->recv_timeout;
+	soap->max_keep_alive = 0; //No limit
+	if (!soap_valid_socket(soap_bind(soap, NULL, endpoint.port, 4))) {
+		soap_print_fault(soap, stderr);
+		soap_free(soap);
+		return;
+	}
+	while (!done) {
+		if (soap_valid_socket(soap_accept(soap))) {
+			soap->keep_alive = 1;
+			do {
+				if (soap_begin_serve(soap)) {
+					break;
+				}
+				if (serveRequest(soap, endpoint)) {
+					soap_send_fault(soap);
+				}
+				soap_destroy(soap);
+				soap_end(soap);
+			} while (soap->keep_alive);
+			soap_force_closesock(soap);
+			soap_destroy(soap);
+			soap_end(soap);
+		} else if (soap->errnum) {
+			soap_print_fault(soap, stderr);
+		}
+		game_mutex.lock();
+		done = finished;
+		game_mutex.unlock();
+	}
+	soap_free(soap);
+}
+
+int ChallengeServer::serveRequest(struct soap* soap, ServerPort& endpoint)
+{
+	soap_peek_element(soap);
+	if (!soap_match_tag(soap, soap->tag, "ns1:getStatus")) {
+		return getStatus(soap, endpoint);
+	}
+	if (!soap_match_tag(soap, soap->tag, "ns1:setActions")) {
+		return setActions(soap, endpoint);
+	}
+	if (!soap_match_tag(soap, soap->tag, "ns1:setAction")) {
+		return setAction(soap, endpoint);
+	}
+	if (!soap_match_tag(soap, soap->tag, "ns1:login")) {
+		return login(soap, endpoint);
+	}
+	return soap->error = SOAP_NO_METHOD;
+}
+
+//Half of the call's delay, to be taken once on the way in and once on the way out
+void ChallengeServer::holdBack(ServerPort& endpoint)
+{
+	int ms = delay_ms;
+	if (jitter_ms > 0) {
+		ms += sfmt_genrand_uint32(endpoint.sfmt) % (jitter_ms+1);
+	}
+	if (ms > 1) {
+		Sleep(ms/2);
+	}
+}
+
+int ChallengeServer::login(struct soap* soap, ServerPort& endpoint)
+{
+	struct __ns1__login request;
+	ns1__loginResponse response;
+	ns1__board* board;
+	ns1__stateArray* column;
+	int x,y;
+	soap_default___ns1__login(soap, &request);
+	if (!soap_get___ns1__login(soap, &request, "-ns1:login", NULL) || endRequest(soap)) {
+		return soap->error;
+	}
+	holdBack(endpoint);
+	response.soap_default(soap);
+	board = soap_new_ns1__board(soap, -1);
+	game_mutex.lock();
+	if (!started) {
+		//The clock starts with the first player in
+		started = true;
+		clock.restart();
+	}
+	board->endGamePoint = state->endgame_tick;
+	for (x = 0; x < state->max_x; x++) {
+		column = soap_new_ns1__stateArray(soap, -1);
+		for (y = 0; y < state->max_y; y++) {
+			if (state->board[x][y] & B_WALL) {
+				column->item.push_back(ns1__state__FULL);
+			} else if (B_ISOOB(state->board[x][y])) {
+				column->item.push_back(ns1__state__OUT_USCOREOF_USCOREBOUNDS);
+			} else {
+				column->item.push_back(ns1__state__EMPTY);
+			}
+		}
+		board->states.push_back(column);
+	}
+	num_calls[endpoint.player]++;
+	game_mutex.unlock();
+	response.return_ = board;
+	holdBack(endpoint);
+	return sendResponse(soap, response, "ns1:loginResponse");
+}
+
+int ChallengeServer::getStatus(struct soap* soap, ServerPort& endpoint)
+{
+	struct __ns1__getStatus request;
+	ns1__getStatusResponse response;
+	ns1__game* game;
+	ns1__player* player;
+	ns1__unit* unit;
+	ns1__bullet* bullet;
+	ns1__blockEvent* block;
+	size_t k;
+	int p,i;
+	soap_default___ns1__getStatus(soap, &request);
+	if (!soap_get___ns1__getStatus(soap, &request, "-ns1:getStatus", NULL) || endRequest(soap)) {
+		return soap->error;
+	}
+	holdBack(endpoint);
+	game_mutex.lock();
+	num_calls[endpoint.player]++;
+	if (!started || over) {
+		game_mutex.unlock();
+		return soap_receiver_fault(soap, started ? "Game over" : "Not logged in", NULL);
+	}
+	response.soap_default(soap);
+	game = soap_new_ns1__game(soap, -1);
+	game->currentTick = state->tickno;
+	game->millisecondsToNextTick = (LONG64)msToNextTick();
+	game->playerName = soap_new_std__string(soap, -1);
+	*game->playerName = player_name[endpoint.player];
+	for (p = 0; p < 2; p++) {
+		player = soap_new_ns1__player(soap, -1);
+		player->name = soap_new_std__string(soap, -1);
+		*player->name = player_name[p];
+		player->base = soap_new_ns1__base(soap, -1);
+		player->base->x = state->base[p].x;
+		player->base->y = state->base[p].y;
+		for (i = 2*p; i < 2*p+2; i++) {
+			if (state->tank[i].active) {
+				unit = soap_new_ns1__unit(soap, -1);
+				unit->id = state->tank[i].id;
+				unit->x = state->tank[i].x;
+				unit->y = state->tank[i].y;
+				unit->direction = hton_direction(soap, state->tank[i].o);
+				player->units.push_back(unit);
+			}
+			if (state->bullet[i].active) {
+				bullet = soap_new_ns1__bullet(soap, -1);
+				bullet->id = state->bullet[i].id;
+				bullet->x = state->bullet[i].x;
+				bullet->y = state->bullet[i].y;
+				bullet->direction = hton_direction(soap, state->bullet[i].o);
+				player->bullets.push_back(bullet);
+			}
+		}
+		game->players.push_back(player);
+	}
+	if (!destroyed.empty()) {
+		game->events = soap_new_ns1__events(soap, -1);
+		for (k = 0; k < destroyed.size(); k++) {
+			block = soap_new_ns1__blockEvent(soap, -1);
+			block->newState = (enum ns1__state*)soap_malloc(soap, sizeof(enum ns1__state));
+			*block->newState = ns1__state__EMPTY;
+			block->point = soap_new_ns1__point(soap, -1);
+			block->point->x = destroyed[k].first;
+			block->point->y = destroyed[k].second;
+			game->events->blockEvents.push_back(block);
+		}
+	}
+	game_mutex.unlock();
+	response.return_ = game;
+	holdBack(endpoint);
+	return sendResponse(soap, response, "ns1:getStatusResponse");
+}
+
+//Under game_mutex. Actions count for the tick they arrive in, like the contest's.
+void ChallengeServer::setCommand(const int player, const int tankid, const enum ns1__action* action)
+{
+	pending[2*player+tankid] = ntoh_cmd(action);
+	if (acted_tick[player] != state->tickno) {
+		acted_tick[player] = state->tickno;
+		num_acted[player]++;
+	}
+}
+
+int ChallengeServer::setAction(struct soap* soap, ServerPort& endpoint)
+{
+	struct __ns1__setAction request;
+	ns1__setActionResponse response;
+	int i;
+	bool found = false;
+	soap_default___ns1__setAction(soap, &request);
+	if (!soap_get___ns1__setAction(soap, &request, "-ns1:setAction", NULL) || endRequest(soap)) {
+		return soap->error;
+	}
+	holdBack(endpoint);
+	game_mutex.lock();
+	num_calls[endpoint.player]++;
+	if (!started || over) {
+		game_mutex.unlock();
+		return soap_receiver_fault(soap, started ? "Game over" : "Not logged in", NULL);
+	}
+	for (i = 0; i < 2 && request.ns1__setAction_; i++) {
+		if (state->tank[2*endpoint.player+i].active && state->tank[2*endpoint.player+i].id == request.ns1__setAction_->arg0) {
+			setCommand(endpoint.player, i, request.ns1__setAction_->arg1);
+			found = true;
+		}
+	}
+	if (!found) {
+		game_mutex.unlock();
+		return soap_sender_fault(soap, "No such unit", NULL);
+	}
+	response.soap_default(soap);
+	response.return_ = soap_new_ns1__delta(soap, -1);
+	response.return_->millisecondsToNextTick = (LONG64)msToNextTick();
+	game_mutex.unlock();
+	holdBack(endpoint);
+	return sendResponse(soap, response, "ns1:setActionResponse");
+}
+
+//arg0 and arg1 go to the player's units in the order getStatus lists them
+int ChallengeServer::setActions(struct soap* soap, ServerPort& endpoint)
+{
+	struct __ns1__setActions request;
+	ns1__setActionsResponse response;
+	const enum ns1__action* action[2] = {NULL, NULL};
+	int i,k;
+	soap_default___ns1__setActions(soap, &request);
+	if (!soap_get___ns1__setActions(soap, &request, "-ns1:setActions", NULL) || endRequest(soap)) {
+		return soap->error;
+	}
+	holdBack(endpoint);
+	game_mutex.lock();
+	num_calls[endpoint.player]++;
+	if (!started || over) {
+		game_mutex.unlock();
+		return soap_receiver_fault(soap, started ? "Game over" : "Not logged in", NULL);
+	}
+	if (request.ns1__setActions_) {
+		action[0] = request.ns1__setActions_->arg0;
+		action[1] = request.ns1__setActions_->arg1;
+	}
+	k = 0;
+	for (i = 0; i < 2; i++) {
+		if (state->tank[2*endpoint.player+i].active) {
+			setCommand(endpoint.player, i, action[k++]);
+		}
+	}
+	response.soap_default(soap);
+	response.return_ = soap_new_ns1__delta(soap, -1);
+	response.return_->millisecondsToNextTick = (LONG64)msToNextTick();
+	game_mutex.unlock();
+	holdBack(endpoint);
+	return sendResponse(soap, response, "ns1:setActionsResponse");
+}
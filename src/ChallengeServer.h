@@ -0,0 +1,81 @@
+//============================================================================
+// Name        : ChallengeServer.h
+// Author      : Jan Gutter
+// Copyright   : To the extent possible under law, Jan Gutter has waived all
+//             : copyright and related or neighboring rights to this work.
+//             : For more information, go to:
+//             : http://creativecommons.org/publicdomain/zero/1.0/
+//             : or consult the README and COPYING files
+// Description : Local stand-in for the contest's ChallengeService
+//============================================================================
+
+#ifndef CHALLENGESERVER_H_
+#define CHALLENGESERVER_H_
+
+#include "soap/soapH.h"
+#include "consts.h"
+#include "PlayoutState.h"
+#include <tinythread.h>
+#include <fast_mutex.h>
+#include <platformstl/performance/performance_counter.hpp>
+#include <SFMT.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+class ChallengeServer;
+
+//One player's endpoint: player 0 listens on the server's port, player 1 on
+//the port after it, like the contest's 7070/7071
+struct ServerPort {
+	ChallengeServer* server;
+	int player;
+	int port;
+	sfmt_t* sfmt; //For the jitter, see new_sfmt
+};
+
+//Plays a game by PlayoutState::simulateTick rules and serves it over the
+//same SOAP contract as the contest server, so NetworkCore can be run and
+//timed end to end on one box. Every call is held back by delay_ms plus up
+//to jitter_ms, half before it's handled and half before the answer goes out.
+class ChallengeServer {
+private:
+	PlayoutState* state;
+	tthread::fast_mutex game_mutex; //Everything below that changes while serving
+	platformstl::performance_counter clock; //Started by the first login
+	bool started;
+	bool over;
+	bool finished; //Tells the ports to stop accepting
+	int pending[4]; //Commands for the coming tick, C_NONE unless set
+	int acted_tick[2]; //The last tick each player sent actions in
+	int num_acted[2];
+	int num_calls[2];
+	int next_bullet_id;
+	vector< pair<int,int> > destroyed; //Walls the last tick took out
+	ServerPort endpoint[2];
+	double elapsedMs();
+	double msToNextTick();
+	void tick();
+	void serve(ServerPort& endpoint);
+	static void portThread(void* param);
+	int serveRequest(struct soap* soap, ServerPort& endpoint);
+	int login(struct soap* soap, ServerPort& endpoint);
+	int getStatus(struct soap* soap, ServerPort& endpoint);
+	int setAction(struct soap* soap, ServerPort& endpoint);
+	int setActions(struct soap* soap, ServerPort& endpoint);
+	void setCommand(const int player, const int tankid, const enum ns1__action* action);
+	void holdBack(ServerPort& endpoint);
+public:
+	int tick_ms;
+	int delay_ms;
+	int jitter_ms;
+	int max_ticks;
+	ChallengeServer(const char* map_file, const int port);
+	~ChallengeServer();
+	//Serves until the game is over and both players have been told
+	void run();
+};
+
+#endif /* CHALLENGESERVER_H_ */
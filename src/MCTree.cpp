@@ -211,12 +211,27 @@ inline int Node::beta(MCTree& tree)
 	return bestmove;
 }
 
+int MCTree::policy_at(unsigned int depth)
+//Playout policy for a playout starting depth plies below the root
+{
+	return (depth < deep_policy_from) ? shallow_policy : deep_policy;
+}
+
 inline void MCTree::handle_task(int taskid, int threadid) {
 	expand_task_t* task = tasks+taskid;
 	int command[4];
+	double result;
 #if DEBUG > 2
 	cout << "Task started on node [" << task->child_ptr << "] by thread " << threadid << endl;
 #endif
+	if (task->kind == TASK_UTILITY) {
+		if (task->job < U_EXPENSIVE(0)) {
+			task->parent_state->updateSimpleUtilityScore(*root_u,task->job-U_SIMPLE(0));
+		} else {
+			task->parent_state->updateExpensiveUtilityScore(*root_u,root_obstacles,task->job-U_EXPENSIVE(0));
+		}
+		return;
+	}
 	command[0] = C_T0(task->alpha,task->beta);
 	command[1] = C_T1(task->alpha,task->beta);
 	command[2] = C_T2(task->alpha,task->beta);
@@ -228,18 +243,19 @@ inline void MCTree::handle_task(int taskid, int threadid) {
 	}
 #endif
 	if (child_legalmove(task->child_ptr)) {
-		memcpy(child_state[threadid],task->parent_state,sizeof(PlayoutState));
+		*child_state[threadid] = *task->parent_state;
 		memcpy(child_state[threadid]->command,command,sizeof(command));
 		child_state[threadid]->simulateTick();
 		if (child_state[threadid]->gameover) {
 			tree[task->child_ptr].terminal = true;
+			result = child_state[threadid]->state_score;
 		} else {
 			tree[task->child_ptr].terminal = false;
-			child_state[threadid]->playout(worker_sfmt[threadid],*root_u);
+			result = child_state[threadid]->playout(worker_sfmt[threadid],*root_u,playout_depth,task->policy);
 		}
 		tree[task->child_ptr].expanded_to = 0;
 		tree[task->child_ptr].r.init();
-		tree[task->child_ptr].r.push(child_state[threadid]->state_score);
+		tree[task->child_ptr].r.push(result);
 #if ASSERT
 #if DEBUG > 2
 		cout << "Node [" << task->child_ptr << "] result: " << tree[task->child_ptr].r.mean() << endl;
@@ -288,7 +304,10 @@ void expand_subnodes(void* thread_param) {
 			cout << "Thread (" << threadid << ") going to sleep" << endl;
 #endif
 			mc_tree->workers_awake--;
-			if (!mc_tree->workers_awake && tasks_claimed > 0) {
+			if (!mc_tree->workers_awake) {
+				//Whoever goes to sleep last tells the main thread, even if it
+				//woke up too late to claim anything. The main thread rechecks
+				//its results anyway.
 #if DEBUG > 1
 				cout << "Thread (" << threadid << ") last one awake and claimed " << tasks_claimed << " tasks, notifying main thread." << endl;
 #endif
@@ -366,8 +385,8 @@ void MCTree::expand_some(unsigned char width, tree_size_t node_id, PlayoutState*
 			}
 		} else {
 			for (i = 0; i < (tree_size_t)width; i++) {
-				memcpy(child_state[0],node_state,sizeof(PlayoutState));
-				results.push_back(child_state[0]->playout(worker_sfmt[0],*root_u));
+				*child_state[0] = *node_state;
+				results.push_back(child_state[0]->playout(worker_sfmt[0],*root_u,playout_depth,policy_at(path.size()-1)));
 			}
 		}
 		//cerr << "Ran out of tree!" << endl;
@@ -385,11 +404,13 @@ void MCTree::expand_some(unsigned char width, tree_size_t node_id, PlayoutState*
 		for (i = 0; i < 4; i++) {
 			if (node_state->tank[i].active) {
 				//Get the cost of the moves
+				cmds.clear();
 				if (node_id == root_id) {
-					node_state->bestCExpensive(i,root_u->expensivecost[i],root_obstacles[i],cmds);
+					node_state->bestCExpensive(i,root_u->expensivecost[i],root_obstacles[i],root_u->footprint[U_EXPENSIVE(i)],cmds);
 				} else {
 					node_state->bestC(i,root_u->simplecost[i/2],cmds);
 				}
+				cmds.top(SCORED_CMDS_MAX);
 				for (j = 0;j < 6; j++) {
 					tree[node_id].cmd_order[i][j] = (unsigned char) cmds[j].first;
 				}
@@ -449,9 +470,11 @@ void MCTree::expand_some(unsigned char width, tree_size_t node_id, PlayoutState*
 								unallocated.begin());
 						unallocated_count--;
 						allocated_count[root_alpha][root_beta]++;
+						tasks[task_last].kind = TASK_EXPAND;
 						tasks[task_last].child_ptr = tree[node_id].child[i][j];
 						tasks[task_last].alpha = i;
 						tasks[task_last].beta = j;
+						tasks[task_last].policy = policy_at(path.size());
 						tasks[task_last].parent_state = node_state;
 						task_last = (task_last + 1) % TASK_RING_SIZE;
 						num_tasks++;
@@ -691,6 +714,47 @@ unsigned int MCTree::best_alpha(unsigned int greedyalpha)
 	}
 }
 
+void MCTree::populate_utility()
+//The six cost matrices don't depend on each other, except that tank 1 plans
+//around the path tank 0 is going to take (and tank 3 around tank 2). So they're
+//farmed out to the workers in two waves.
+{
+	const int wave[2][4] = {
+			{U_SIMPLE(PLAYER0),U_SIMPLE(PLAYER1),U_EXPENSIVE(0),U_EXPENSIVE(2)},
+			{U_EXPENSIVE(1),U_EXPENSIVE(3),-1,-1}};
+	unsigned int w,i,num_tasks;
+
+	root_u->resize(root_state->board.width,root_state->board.height);
+	for (w = 0; w < 2; w++) {
+		taskqueue_mutex.lock();
+		num_tasks = 0;
+		for (i = 0; i < 4 && wave[w][i] >= 0; i++) {
+			tasks[task_last].kind = TASK_UTILITY;
+			tasks[task_last].job = wave[w][i];
+			tasks[task_last].child_ptr = THREADID_UNEXPLORED;
+			tasks[task_last].parent_state = root_state;
+			tasks[task_last].alpha = 0;
+			tasks[task_last].beta = 0;
+			tasks[task_last].policy = 0;
+			task_last = (task_last + 1) % TASK_RING_SIZE;
+			num_tasks++;
+		}
+		taskqueue_mutex.unlock();
+		tasks_available.notify_all();
+		if (w == 1) {
+			//simplecost is done: build the greedy table while the workers are busy
+			root_state->updateGreedyCommands(*root_u);
+		}
+		task_result_mutex.lock();
+		while (num_results() != num_tasks) {
+			workers_finished.wait(task_result_mutex);
+		}
+		//Nothing to backprop, just clear them out
+		task_result_first = task_result_last;
+		task_result_mutex.unlock();
+	}
+}
+
 void MCTree::init(PlayoutState* reference_state)
 {
 	vector<Move> path;
@@ -712,16 +776,16 @@ void MCTree::init(PlayoutState* reference_state)
 
 	root_id = 1;
 	allocated_to_root.push_back(root_id);
-	memcpy(root_state,reference_state,sizeof(PlayoutState));
+	*root_state = *reference_state;
+	root_state->drawWalls();
 	root_state->drawBases();
 	root_state->drawTanks();
 	root_state->drawBullets();
 	root_state->updateCanFire();
-	root_state->updateSimpleUtilityScores(*root_u,root_obstacles);
-	root_state->updateExpensiveUtilityScores(*root_u,root_obstacles);
-	memcpy(child_state[0],root_state,sizeof(PlayoutState));
+	populate_utility();
+	*child_state[0] = *root_state;
 	tree[root_id].r.init();
-	tree[root_id].r.push(child_state[0]->playout(worker_sfmt[0],*root_u));
+	tree[root_id].r.push(child_state[0]->playout(worker_sfmt[0],*root_u,playout_depth,policy_at(0)));
 	tree[root_id].terminal = false;
 	zero.alpha = 0;
 	zero.beta = 0;
@@ -753,16 +817,16 @@ void MCTree::reset(PlayoutState* reference_state)
 
 	}
 
-	memcpy(root_state,reference_state,sizeof(PlayoutState));
+	*root_state = *reference_state;
+	root_state->drawWalls();
 	root_state->drawBases();
 	root_state->drawTanks();
 	root_state->drawBullets();
 	root_state->updateCanFire();
-	root_state->updateSimpleUtilityScores(*root_u,root_obstacles);
-	root_state->updateExpensiveUtilityScores(*root_u,root_obstacles);
-	memcpy(child_state[0],root_state,sizeof(PlayoutState));
+	populate_utility();
+	*child_state[0] = *root_state;
 	tree[root_id].r.init();
-	tree[root_id].r.push(child_state[0]->playout(worker_sfmt[0],*root_u));
+	tree[root_id].r.push(child_state[0]->playout(worker_sfmt[0],*root_u,playout_depth,policy_at(0)));
 	tree[root_id].terminal = false;
 	zero.alpha = 0;
 	zero.beta = 0;
@@ -786,6 +850,10 @@ MCTree::MCTree()
 	//tree_size = 100000l;
 	tree_size = 100000l;
 	tree = new Node[tree_size];
+	playout_depth = PLAYOUT_DEPTH;
+	shallow_policy = PLAYOUT_SHALLOW;
+	deep_policy = PLAYOUT_DEEP;
+	deep_policy_from = PLAYOUT_DEEP_FROM;
 	unallocated_count = tree_size-2; //0 is reserved and 1 belongs to root
 	for (i = 2; i < tree_size; i++) {
 		unallocated.push_back(i);
@@ -814,7 +882,7 @@ MCTree::MCTree()
 		expand_thread_param_t* expand_param = new expand_thread_param_t;
 		expand_param->threadid = i;
 		expand_param->mc_tree = this;
-		sfmt_t* sfmt = new sfmt_t;
+		sfmt_t* sfmt = new_sfmt();
 		sfmt_init_gen_rand(sfmt, rand());
 		worker_sfmt.push_back(sfmt);
 		expand_worker[i] = new tthread::thread(expand_subnodes,expand_param);
@@ -840,7 +908,7 @@ MCTree::~MCTree()
 		expand_worker[i]->join();
 		delete expand_worker[i];
 		delete child_state[i];
-		delete worker_sfmt[i];
+		delete_sfmt(worker_sfmt[i]);
 	}
 	delete[] tree;
 	delete root_state;
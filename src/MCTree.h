@@ -20,6 +20,10 @@
 #include <math.h>
 #include <tinythread.h>
 #include <SFMT.h>
+#include <stdlib.h>
+#ifdef WIN32
+#include <malloc.h>
+#endif
 
 using namespace std;
 
@@ -34,19 +38,47 @@ const unsigned int MINTHREADS = 2;
 #define RESULT_RING_SIZE (2048)
 #define THREADID_UNEXPLORED 0
 #define THREADID_PRUNED 1
+#define TASK_EXPAND 0 //Simulate a child and play it out
+#define TASK_UTILITY 1 //Compute one of the U_JOBS pieces of root_u
 
 class MCTree;
 
+//SFMT's SSE2 refill wants its state 16 byte aligned, and new only promises 8 on Win32
+inline sfmt_t* new_sfmt()
+{
+	void* p;
+#ifdef WIN32
+	p = _aligned_malloc(sizeof(sfmt_t),16);
+#else
+	if (posix_memalign(&p,16,sizeof(sfmt_t)) != 0) {
+		p = NULL;
+	}
+#endif
+	return (sfmt_t*)p;
+}
+
+inline void delete_sfmt(sfmt_t* sfmt)
+{
+#ifdef WIN32
+	_aligned_free(sfmt);
+#else
+	free(sfmt);
+#endif
+}
+
 struct expand_thread_param_t {
 	MCTree* mc_tree;
 	unsigned int threadid;
 };
 
 struct expand_task_t {
+	int kind;
+	int job;
 	tree_size_t child_ptr;
 	PlayoutState* parent_state;
 	int alpha;
 	int beta;
+	int policy; //PLAYOUT_ policy for the child's playout
 };
 
 struct expand_result_t {
@@ -64,6 +96,10 @@ public:
 	Node* tree;
 
 	unsigned int num_workers;
+	int playout_depth; //see PLAYOUT_DEPTH
+	int shallow_policy; //see PLAYOUT_SHALLOW
+	int deep_policy; //see PLAYOUT_DEEP
+	unsigned int deep_policy_from; //see PLAYOUT_DEEP_FROM
 
 	tthread::mutex taskqueue_mutex;
 	tthread::condition_variable tasks_available;
@@ -94,9 +130,11 @@ public:
 	list <tree_size_t> allocated_to_root;
 	unsigned int num_results();
 	unsigned int best_alpha(unsigned int greedy_alpha);
+	int policy_at(unsigned int depth);
 	void handle_task(int taskid, int threadid);
 	void post_result(int alpha, int beta);
 	bool taskqueue_empty();
+	void populate_utility();
 	void init(PlayoutState* reference_state);
 	void reset(PlayoutState* reference_state);
 	void select(unsigned char width,vector<Move>& path, tree_size_t& node_id, PlayoutState* node_state);
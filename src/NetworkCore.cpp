@@ -22,6 +22,9 @@
 #include <StatCounter.hpp>
 #include "MCTree.h"
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <math.h>
 
 #define DEBUG 0
 
@@ -31,6 +34,14 @@
 #define HALFLIMP 0
 #define AREYOUNUTS 0
 #define SAVESTARTMAP 0
+#define BENCHSOAP_ROUND 25
+#define SEARCH_PUBLISH_MS 20 //How often the search hands ioLoop its best actions
+#define SEARCH_IDLE_MS 5
+#define TIMING_MISS_TARGET 0.01 //Fraction of ticks we're prepared to send actions too late for
+#define TIMING_RETRY_MS 5 //Least wait before polling again for a tick that hasn't started
+#define CAPTURE_ID "battletanks-capture" //SoapCapture's gSOAP plugin id
+#define REPLAY_DECISION_MS 5000 //Longest replayLoop waits for the search to act on a tick
+#define BATCH_MAX_FAULTS 3 //setActions faults in a row before we stop trying it
 
 const int fixed_commands[NUMPLAYERS][NUMTANKS][NUMC] = {
 		{ //"Player One"
@@ -103,13 +114,591 @@ inline int ntoh_direction(enum ns1__direction *direction) {
 	return O_UP;
 }
 
-NetworkCore::NetworkCore(const char* soap_endpoint)
+//Keeps 16 byte alignment for whatever soap_malloc is asked for
+#define ARENA_ALIGN(n) (((n)+15) & ~(size_t)15)
+#define ARENA_BLOCK 65536
+
+SoapArena::SoapArena()
+{
+	used = 0;
+}
+
+SoapArena::~SoapArena()
+{
+	size_t i;
+	for (i = 0; i < block.size(); i++) {
+		free(block[i].first);
+	}
+}
+
+void* SoapArena::alloc(size_t n)
+{
+	char* p;
+	n = ARENA_ALIGN(n);
+	if (block.empty() || used + n > block.back().second) {
+		block.push_back(make_pair((char*)malloc(max(n,(size_t)ARENA_BLOCK)),max(n,(size_t)ARENA_BLOCK)));
+		if (!block.back().first) {
+			block.pop_back();
+			return NULL;
+		}
+		used = 0;
+	}
+	p = block.back().first+used;
+	used += n;
+	return p;
+}
+
+void SoapArena::rewind()
+{
+	size_t i,total;
+	//Spilled over: swap the blocks for a single one that holds it all
+	if (block.size() > 1) {
+		total = 0;
+		for (i = 0; i < block.size(); i++) {
+			total += block[i].second;
+			free(block[i].first);
+		}
+		block.clear();
+		block.push_back(make_pair((char*)malloc(total),total));
+		if (!block.back().first) {
+			block.pop_back();
+		}
+	}
+	used = 0;
+}
+
+void* SoapArena::soapMalloc(struct soap* soap, size_t n)
+{
+	return ((SoapArena*)soap->user)->alloc(n);
+}
+
+LatencyWindow::LatencyWindow()
+{
+	next = 0;
+	sample.reserve(LATENCY_SAMPLES);
+}
+
+void LatencyWindow::push(double ms)
+{
+	if (sample.size() < LATENCY_SAMPLES) {
+		sample.push_back(ms);
+	} else {
+		sample[next] = ms;
+	}
+	next = (next+1) % LATENCY_SAMPLES;
+}
+
+double LatencyWindow::quantile(double q) const
+{
+	size_t k;
+	if (sample.empty()) {
+		return LATENCY_UNKNOWN_MS;
+	}
+	//k is the sample with a fraction q of the window at or below it, until
+	//the window is too small to hold one above the q-th quantile
+	k = (size_t)ceil(q*sample.size());
+	if (k < 1) {
+		k = 1;
+	}
+	if (k >= sample.size()) {
+		return *max_element(sample.begin(), sample.end());
+	}
+	scratch = sample;
+	nth_element(scratch.begin(), scratch.begin()+(k-1), scratch.end());
+	return scratch[k-1];
+}
+
+size_t LatencyWindow::count() const
+{
+	return sample.size();
+}
+
+TickTimer::TickTimer()
+{
+	extra = 0.0;
+	num_sent = 0;
+	num_missed = 0;
+	tick_length = 0.0;
+}
+
+double TickTimer::sendBudget() const
+{
+	double budget = submit.quantile(1.0-TIMING_MISS_TARGET) + extra;
+	//Never more than half a tick, or with no samples yet on a short tick
+	//nothing would ever go out to give us one
+	if (tick_length > 0.0) {
+		budget = min(budget, tick_length/2);
+	}
+	return budget;
+}
+
+double TickTimer::retryDelay() const
+{
+	return max(getstatus.quantile(0.5), (double)TIMING_RETRY_MS);
+}
+
+bool TickTimer::sent(double ms_left, double ms_to_next)
+{
+	bool missed;
+	num_sent++;
+	//Had the tick still been on, ms_to_next would be no more than ms_left.
+	//Half a tick more and the server has moved on.
+	missed = (tick_length > 0.0) && (ms_to_next > ms_left + tick_length/2);
+	if (missed) {
+		//Latency the window hasn't caught up with, back off hard, but no
+		//further than sendBudget would let it count
+		num_missed++;
+		extra += extra + submit.quantile(0.5);
+		if (tick_length > 0.0) {
+			extra = min(extra, max(tick_length/2 - submit.quantile(1.0-TIMING_MISS_TARGET), 0.0));
+		}
+	} else {
+		//By the time it hits again the window has mostly caught up
+		extra /= 2;
+	}
+	return missed;
+}
+
+void TickTimer::report() const
+{
+	cout << "getStatus: " << getstatus.quantile(0.5) << " ms p50, " << getstatus.quantile(0.99) << " ms p99" << endl;
+	cout << "Decode: " << decode.quantile(0.5) << " ms p50, " << decode.quantile(0.99) << " ms p99" << endl;
+	cout << "Action submission: " << submit.quantile(0.5) << " ms p50, " << submit.quantile(0.99) << " ms p99" << endl;
+	cout << "Missed " << num_missed << " of " << num_sent << " ticks (target " << TIMING_MISS_TARGET*100.0
+			<< "%), send budget " << sendBudget() << " ms" << endl;
+}
+
+bool SoapCapture::open(struct soap* soap, const char* filename)
+{
+	out.open(filename, ios::out | ios::binary | ios::trunc);
+	if (!out) {
+		return false;
+	}
+	clock.restart();
+	sent_at = 0.0;
+	received_at = 0.0;
+	fsend = soap->fsend;
+	frecv = soap->frecv;
+	soap->fsend = captureSend;
+	soap->frecv = captureRecv;
+	return soap_register_plugin_arg(soap, plugin, this) == SOAP_OK;
+}
+
+double SoapCapture::elapsedMs()
+{
+	clock.stop();
+	return (double)clock.get_microseconds()/1000.0;
+}
+
+void SoapCapture::write(const char direction, const double at, const string& bytes)
+{
+	out << direction << ' ' << fixed << setprecision(3) << at << ' ' << bytes.size() << '\n';
+	out.write(bytes.data(), bytes.size());
+}
+
+void SoapCapture::flush()
+{
+	if (!sent.empty()) {
+		write('>', sent_at, sent);
+		sent.clear();
+	}
+	if (!received.empty()) {
+		write('<', received_at, received);
+		received.clear();
+	}
+	out.flush();
+}
+
+int SoapCapture::captureSend(struct soap* soap, const char* buf, size_t len)
+{
+	SoapCapture* capture = (SoapCapture*)soap_lookup_plugin(soap, CAPTURE_ID);
+	if (capture->sent.empty()) {
+		//A new call, anything left over belongs to the last one
+		if (!capture->received.empty()) {
+			capture->flush();
+		}
+		capture->sent_at = capture->elapsedMs();
+	}
+	capture->sent.append(buf, len);
+	return capture->fsend(soap, buf, len);
+}
+
+size_t SoapCapture::captureRecv(struct soap* soap, char* buf, size_t len)
+{
+	SoapCapture* capture = (SoapCapture*)soap_lookup_plugin(soap, CAPTURE_ID);
+	size_t n = capture->frecv(soap, buf, len);
+	if (n > 0) {
+		if (capture->received.empty()) {
+			capture->received_at = capture->elapsedMs();
+		}
+		capture->received.append(buf, n);
+	}
+	return n;
+}
+
+int SoapCapture::plugin(struct soap*, struct soap_plugin* p, void* arg)
+{
+	p->id = CAPTURE_ID;
+	p->data = arg;
+	p->fcopy = NULL;
+	p->fdelete = pluginDelete;
+	return SOAP_OK;
+}
+
+//The capture belongs to NetworkCore, not the soap context
+void SoapCapture::pluginDelete(struct soap*, struct soap_plugin*)
+{
+}
+
+//The readers below decode getStatus and login responses straight into
+//StatusFrame/BoardFrame. They follow soapC.cpp's soap_in_ functions, but
+//fill our own structs instead of instantiating ns1__ classes, so a response
+//costs no allocations beyond the strings gSOAP reads.
+//Each tries one child element and moves on to the next if it matched
+#define TRY_IN(in) if (soap->error == SOAP_TAG_MISMATCH && (in)) continue
+
+//Ends a reader's loop over its children, skipping any it doesn't know
+#define END_CHILDREN(soap) \
+	if (soap->error == SOAP_TAG_MISMATCH) \
+		soap->error = soap_ignore_element(soap); \
+	if (soap->error == SOAP_NO_TAG) \
+		break; \
+	if (soap->error) \
+		return false
+
+static bool readPoint(struct soap* soap, const char* tag, int& x, int& y)
+{
+	if (soap_element_begin_in(soap, tag, 0, NULL)) {
+		return false;
+	}
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			TRY_IN(soap_in_int(soap, "x", &x, "xsd:int"));
+			TRY_IN(soap_in_int(soap, "y", &y, "xsd:int"));
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, tag)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool readUnit(struct soap* soap, const char* tag, TankState& unit)
+{
+	enum ns1__direction direction;
+	bool directed = false;
+	if (soap_element_begin_in(soap, tag, 0, NULL)) {
+		return false;
+	}
+	unit.id = 0;
+	unit.x = 0;
+	unit.y = 0;
+	unit.active = 1;
+	unit.tag = 0;
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			if (soap_in_ns1__direction(soap, "direction", &direction, "ns1:direction")) {
+				directed = true;
+				continue;
+			}
+			TRY_IN(soap_in_int(soap, "id", &unit.id, "xsd:int"));
+			TRY_IN(soap_in_int(soap, "x", &unit.x, "xsd:int"));
+			TRY_IN(soap_in_int(soap, "y", &unit.y, "xsd:int"));
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, tag)) {
+			return false;
+		}
+	}
+	unit.o = ntoh_direction(directed ? &direction : NULL);
+	return true;
+}
+
+static bool readBullet(struct soap* soap, const char* tag, BulletState& bullet)
+{
+	enum ns1__direction direction;
+	bool directed = false;
+	if (soap_element_begin_in(soap, tag, 0, NULL)) {
+		return false;
+	}
+	bullet.id = 0;
+	bullet.x = 0;
+	bullet.y = 0;
+	bullet.active = 1;
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			if (soap_in_ns1__direction(soap, "direction", &direction, "ns1:direction")) {
+				directed = true;
+				continue;
+			}
+			TRY_IN(soap_in_int(soap, "id", &bullet.id, "xsd:int"));
+			TRY_IN(soap_in_int(soap, "x", &bullet.x, "xsd:int"));
+			TRY_IN(soap_in_int(soap, "y", &bullet.y, "xsd:int"));
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, tag)) {
+			return false;
+		}
+	}
+	bullet.o = ntoh_direction(directed ? &direction : NULL);
+	return true;
+}
+
+static bool readPlayer(struct soap* soap, const char* tag, StatusPlayer& player)
+{
+	TankState unit;
+	BulletState bullet;
+	if (soap_element_begin_in(soap, tag, 0, NULL)) {
+		return false;
+	}
+	player.named = false;
+	player.based = false;
+	player.num_units = 0;
+	player.num_bullets = 0;
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			if (readPoint(soap, "base", player.base_x, player.base_y)) {
+				player.based = true;
+				continue;
+			}
+			if (soap->error == SOAP_TAG_MISMATCH && readUnit(soap, "units", unit)) {
+				if (player.num_units < STATUS_UNITS) {
+					player.unit[player.num_units] = unit;
+				}
+				player.num_units++;
+				continue;
+			}
+			if (soap->error == SOAP_TAG_MISMATCH && readBullet(soap, "bullets", bullet)) {
+				if (player.num_bullets < STATUS_UNITS) {
+					player.bullet[player.num_bullets] = bullet;
+				}
+				player.num_bullets++;
+				continue;
+			}
+			if (soap->error == SOAP_TAG_MISMATCH && soap_in_std__string(soap, "name", &player.name, "xsd:string")) {
+				player.named = true;
+				continue;
+			}
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, tag)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool readBlockEvent(struct soap* soap, const char* tag, BlockDelta& block)
+{
+	enum ns1__state newstate;
+	bool pointed = false;
+	if (soap_element_begin_in(soap, tag, 0, NULL)) {
+		return false;
+	}
+	block.newstate = -1;
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			if (soap_in_ns1__state(soap, "newState", &newstate, "ns1:state")) {
+				block.newstate = newstate;
+				continue;
+			}
+			if (soap->error == SOAP_TAG_MISMATCH && readPoint(soap, "point", block.x, block.y)) {
+				pointed = true;
+				continue;
+			}
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, tag)) {
+			return false;
+		}
+	}
+	if (!pointed) {
+		//Nowhere to apply it
+		block.newstate = -1;
+	}
+	return true;
+}
+
+static bool readEvents(struct soap* soap, const char* tag, vector<BlockDelta>& blocks)
+{
+	BlockDelta block;
+	if (soap_element_begin_in(soap, tag, 0, NULL)) {
+		return false;
+	}
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			if (readBlockEvent(soap, "blockEvents", block)) {
+				if (block.newstate >= 0) {
+					blocks.push_back(block);
+				}
+				continue;
+			}
+			//unitEvents are in the past, skip them
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, tag)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool readGame(struct soap* soap, const char* tag, StatusFrame& frame)
+{
+	StatusPlayer spare;
+	if (soap_element_begin_in(soap, tag, 0, NULL)) {
+		return false;
+	}
+	frame.tick = 0;
+	frame.ms_to_next = 0;
+	frame.named = false;
+	frame.num_players = 0;
+	frame.has_events = false;
+	frame.blocks.clear();
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			TRY_IN(soap_in_int(soap, "currentTick", &frame.tick, "xsd:int"));
+			TRY_IN(soap_in_LONG64(soap, "millisecondsToNextTick", &frame.ms_to_next, "xsd:long"));
+			if (soap->error == SOAP_TAG_MISMATCH && readEvents(soap, "events", frame.blocks)) {
+				frame.has_events = true;
+				continue;
+			}
+			if (soap->error == SOAP_TAG_MISMATCH && soap_in_std__string(soap, "playerName", &frame.player_name, "xsd:string")) {
+				frame.named = true;
+				continue;
+			}
+			if (soap->error == SOAP_TAG_MISMATCH && readPlayer(soap, "players", frame.num_players < STATUS_PLAYERS ? frame.player[frame.num_players] : spare)) {
+				frame.num_players++;
+				continue;
+			}
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, tag)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool readStatus(struct soap* soap, StatusFrame& frame)
+{
+	bool returned = false;
+	if (soap_element_begin_in(soap, "ns1:getStatusResponse", 0, NULL)) {
+		return false;
+	}
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			if (readGame(soap, "return", frame)) {
+				returned = true;
+				continue;
+			}
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, "ns1:getStatusResponse")) {
+			return false;
+		}
+	}
+	if (!returned) {
+		soap->error = SOAP_OCCURS;
+		return false;
+	}
+	return true;
+}
+
+static bool readColumn(struct soap* soap, const char* tag, BoardFrame& board)
+{
+	enum ns1__state square;
+	if (soap_element_begin_in(soap, tag, 0, NULL)) {
+		return false;
+	}
+	board.column.push_back(0);
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			if (soap_in_ns1__state(soap, "item", &square, "ns1:state")) {
+				board.square.push_back((unsigned char)square);
+				board.column.back()++;
+				continue;
+			}
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, tag)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool readBoardReturn(struct soap* soap, const char* tag, BoardFrame& board)
+{
+	if (soap_element_begin_in(soap, tag, 0, NULL)) {
+		return false;
+	}
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			TRY_IN(soap_in_int(soap, "endGamePoint", &board.endgame_tick, "xsd:int"));
+			TRY_IN(readColumn(soap, "states", board));
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, tag)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool readBoard(struct soap* soap, BoardFrame& board)
+{
+	bool returned = false;
+	board.endgame_tick = 0;
+	board.column.clear();
+	board.square.clear();
+	if (soap_element_begin_in(soap, "ns1:loginResponse", 0, NULL)) {
+		return false;
+	}
+	if (soap->body) {
+		for (;;) {
+			soap->error = SOAP_TAG_MISMATCH;
+			if (readBoardReturn(soap, "return", board)) {
+				returned = true;
+				continue;
+			}
+			END_CHILDREN(soap);
+		}
+		if (soap_element_end_in(soap, "ns1:loginResponse")) {
+			return false;
+		}
+	}
+	if (!returned) {
+		soap->error = SOAP_OCCURS;
+		return false;
+	}
+	return true;
+}
+
+NetworkCore::NetworkCore(const char* soap_endpoint) : s(SOAP_IO_DEFAULT | SOAP_IO_KEEPALIVE)
 {
 	int i;
 	state = new PlayoutState;
 	state_synced = false;
 	soaperr = SOAP_OK;
 	s.soap_endpoint = soap_endpoint;
+	//One connection and one soap context for the whole game, see recycle()
+	s.soap->user = &arena;
+	s.soap->fmalloc = SoapArena::soapMalloc;
+	capture = NULL;
+	replay_calls = NULL;
+	replay_speed = 1.0;
 	state->max_x = 0;
 	state->max_y = 0;
 	state->tickno = 0;
@@ -124,59 +713,225 @@ NetworkCore::NetworkCore(const char* soap_endpoint)
 
 NetworkCore::~NetworkCore()
 {
+	//The plugin's left in s, but it never touches the capture on the way out
+	delete capture;
 	delete state;
 }
 
-void NetworkCore::login() {
-	//TODO: Need to loop to re-attempt login
-	do {
-		int square;
-		state->min_x = 0;
-		state->min_y = 0;
-		state->max_x = 0;
-		ns1__login login_req;
-		ns1__loginResponse login_resp;
-		soaperr = s.login(&login_req, &login_resp);
-		if (soaperr == SOAP_OK) {
-			state->endgame_tick = login_resp.return_->endGamePoint;
-			if (state->endgame_tick < 1) {
-				state->endgame_tick = 200;
-			}
+//Drops everything the last call deserialized, but keeps the connection
+//open and the arena's memory for the next call
+void NetworkCore::recycle()
+{
+	s.destroy();
+	arena.rewind();
+	if (capture) {
+		capture->flush();
+	}
+}
+
+//The request half of s.getStatus and s.login, as the generated proxy
+//sends it. The responses go to recvStatus and recvBoard instead.
+static int sendGetStatus(struct soap* soap, const char* endpoint)
+{
+	ns1__getStatus req;
+	struct __ns1__getStatus tmp;
+	tmp.ns1__getStatus_ = &req;
+	soap->encodingStyle = NULL;
+	soap_begin(soap);
+	soap_set_version(soap, 1); /* SOAP1.1 */
+	soap_serializeheader(soap);
+	soap_serialize___ns1__getStatus(soap, &tmp);
+	if (soap_begin_count(soap)) {
+		return soap->error;
+	}
+	if (soap->mode & SOAP_IO_LENGTH) {
+		if (soap_envelope_begin_out(soap)
+				|| soap_putheader(soap)
+				|| soap_body_begin_out(soap)
+				|| soap_put___ns1__getStatus(soap, &tmp, "-ns1:getStatus", NULL)
+				|| soap_body_end_out(soap)
+				|| soap_envelope_end_out(soap)) {
+			return soap->error;
+		}
+	}
+	if (soap_end_count(soap)) {
+		return soap->error;
+	}
+	if (soap_connect(soap, soap_url(soap, endpoint, NULL), "")
+			|| soap_envelope_begin_out(soap)
+			|| soap_putheader(soap)
+			|| soap_body_begin_out(soap)
+			|| soap_put___ns1__getStatus(soap, &tmp, "-ns1:getStatus", NULL)
+			|| soap_body_end_out(soap)
+			|| soap_envelope_end_out(soap)
+			|| soap_end_send(soap)) {
+		return soap_closesock(soap);
+	}
+	return SOAP_OK;
+}
+
+static int sendLogin(struct soap* soap, const char* endpoint)
+{
+	ns1__login req;
+	struct __ns1__login tmp;
+	tmp.ns1__login_ = &req;
+	soap->encodingStyle = NULL;
+	soap_begin(soap);
+	soap_set_version(soap, 1); /* SOAP1.1 */
+	soap_serializeheader(soap);
+	soap_serialize___ns1__login(soap, &tmp);
+	if (soap_begin_count(soap)) {
+		return soap->error;
+	}
+	if (soap->mode & SOAP_IO_LENGTH) {
+		if (soap_envelope_begin_out(soap)
+				|| soap_putheader(soap)
+				|| soap_body_begin_out(soap)
+				|| soap_put___ns1__login(soap, &tmp, "-ns1:login", NULL)
+				|| soap_body_end_out(soap)
+				|| soap_envelope_end_out(soap)) {
+			return soap->error;
+		}
+	}
+	if (soap_end_count(soap)) {
+		return soap->error;
+	}
+	if (soap_connect(soap, soap_url(soap, endpoint, NULL), "")
+			|| soap_envelope_begin_out(soap)
+			|| soap_putheader(soap)
+			|| soap_body_begin_out(soap)
+			|| soap_put___ns1__login(soap, &tmp, "-ns1:login", NULL)
+			|| soap_body_end_out(soap)
+			|| soap_envelope_end_out(soap)
+			|| soap_end_send(soap)) {
+		return soap_closesock(soap);
+	}
+	return SOAP_OK;
+}
+
+//s.getStatus, decoded by readStatus
+int NetworkCore::fetchStatus(StatusFrame& frame)
+{
+	if (sendGetStatus(s.soap, s.soap_endpoint)) {
+		return s.soap->error;
+	}
+	return recvStatus(frame);
+}
+
+//s.login, decoded by readBoard
+int NetworkCore::fetchBoard(BoardFrame& board)
+{
+	if (sendLogin(s.soap, s.soap_endpoint)) {
+		return s.soap->error;
+	}
+	return recvBoard(board);
+}
+
+//The response half: reads from the connection, or from s.soap->is if set
+int NetworkCore::recvStatus(StatusFrame& frame)
+{
+	struct soap* soap = s.soap;
+	if (soap_begin_recv(soap)
+			|| soap_envelope_begin_in(soap)
+			|| soap_recv_header(soap)
+			|| soap_body_begin_in(soap)) {
+		return soap_closesock(soap);
+	}
+	if (!readStatus(soap, frame)) {
+		return soap_recv_fault(soap, 0);
+	}
+	if (soap_body_end_in(soap)
+			|| soap_envelope_end_in(soap)
+			|| soap_end_recv(soap)) {
+		return soap_closesock(soap);
+	}
+	return soap_closesock(soap);
+}
+
+int NetworkCore::recvBoard(BoardFrame& board)
+{
+	struct soap* soap = s.soap;
+	if (soap_begin_recv(soap)
+			|| soap_envelope_begin_in(soap)
+			|| soap_recv_header(soap)
+			|| soap_body_begin_in(soap)) {
+		return soap_closesock(soap);
+	}
+	if (!readBoard(soap, board)) {
+		return soap_recv_fault(soap, 0);
+	}
+	if (soap_body_end_in(soap)
+			|| soap_envelope_end_in(soap)
+			|| soap_end_recv(soap)) {
+		return soap_closesock(soap);
+	}
+	return soap_closesock(soap);
+}
+
+//Sets state's board up from a login response
+void NetworkCore::applyBoard(BoardFrame& board)
+{
+	int square,x,y,height;
+	size_t next;
+	state->endgame_tick = board.endgame_tick;
+	if (state->endgame_tick < 1) {
+		state->endgame_tick = 200;
+	}
 #if DEBUG
-			cout << "Endgame starts at: " << state->endgame_tick << endl;
+	cout << "Endgame starts at: " << state->endgame_tick << endl;
 #endif
-			for (vector<ns1__stateArray*>::iterator boardx = login_resp.return_->states.begin(); boardx != login_resp.return_->states.end(); ++boardx) {
-				state->max_y = 0;
-				for (vector<ns1__state>::iterator boardy = (*boardx)->item.begin(); boardy != (*boardx)->item.end() ; ++boardy) {
-#if DEBUG
-					cout << *boardy;
-#endif
-					switch (*boardy) {
-					case ns1__state__FULL:
-						square = B_WALL;
-						break;
-					case ns1__state__OUT_USCOREOF_USCOREBOUNDS:
-						square = B_OOB;
-						break;
-					default:
-					case ns1__state__NONE:
-						cerr << "Warning, received NONE state on square!" << endl;
-					case ns1__state__EMPTY:
-						square = B_EMPTY;
-					}
-					state->board[state->max_x][state->max_y] = square;
-					state->max_y++;
-				}
+	//Size the board to the longest column, anything a column is short of is out of bounds
+	height = 0;
+	for (x = 0; x < (int)board.column.size(); x++) {
+		height = max(height,board.column[x]);
+	}
+	state->resize((int)board.column.size(),height);
+	next = 0;
+	for (x = 0; x < (int)board.column.size(); x++) {
+		for (y = 0; y < board.column[x]; y++) {
 #if DEBUG
-				cout << endl;
+			cout << (int)board.square[next];
 #endif
-				state->max_x++;
+			switch (board.square[next++]) {
+			case ns1__state__FULL:
+				square = B_WALL;
+				break;
+			case ns1__state__OUT_USCOREOF_USCOREBOUNDS:
+				square = B_OOB;
+				break;
+			default:
+			case ns1__state__NONE:
+				cerr << "Warning, received NONE state on square!" << endl;
+			case ns1__state__EMPTY:
+				square = B_EMPTY;
+			}
+			state->board[x][y] = square;
+		}
+		if (y < height) {
+			cerr << "Warning, board column " << x << " is " << y << " squares short of " << height << "!" << endl;
+			for (; y < height; y++) {
+				state->board[x][y] = B_OOB;
 			}
 		}
+#if DEBUG
+		cout << endl;
+#endif
+	}
+}
+
+void NetworkCore::login() {
+	BoardFrame board;
+	//TODO: Need to loop to re-attempt login
+	do {
+		soaperr = fetchBoard(board);
+		if (soaperr == SOAP_OK) {
+			applyBoard(board);
+		}
 		if (soaperr != SOAP_OK) {
 			s.soap_stream_fault(std::cerr);
 			Sleep(250);
 		}
+		recycle();
 		state_synced = false;
 		/*PlayoutState p;
 	memset(&p,0,sizeof(p));
@@ -191,414 +946,367 @@ void NetworkCore::login() {
 	} while (soaperr != SOAP_OK);
 }
 
-void NetworkCore::play()
+//Brings state in line with a getStatus response: players, units, bullets
+//and the board. state->tickno is left to the caller.
+void NetworkCore::syncStatus(StatusFrame& frame)
 {
-	StatCounter stat_getstatus;
-	StatCounter stat_setaction;
-	platformstl::performance_counter soap_timer;
-	platformstl::performance_counter comms_timer;
-	platformstl::performance_counter ai_timer;
-	platformstl::performance_counter loop_timer;
 	bool its_me;
 	int num_recv,player_offset,check;
-	TankState received_tanks[2];
-	BulletState received_bullets[2];
+	TankState* received_tanks;
+	BulletState* received_bullets;
 	int i,j;
-	long long int nexttick;
-	long int lasttick = 0;
-	int safety_margin = 500; // send message 750ms before end of tick.
-	int settle_time = 500; // only poll getStatus 750ms after the beginning of the tick.
-	bool repeated_tick;
-	bool skipped_tick;
-	MCTree* mc_tree = new MCTree;
-	PlayoutState* node_state = new PlayoutState;
-#if SAVESTARTMAP
-	bool firstrun = true;
-#endif
-	stat_getstatus.init();
-	stat_setaction.init();
-
-	while (soaperr == SOAP_OK) {
-		comms_timer.restart();
-		ns1__getStatus getStatus_req;
-		ns1__getStatusResponse getStatus_resp;
-		soap_timer.restart();
-		soaperr = s.getStatus(&getStatus_req, &getStatus_resp);
-		soap_timer.stop();
-		stat_getstatus.push((double)soap_timer.get_milliseconds());
-		skipped_tick = false;
-		if (soaperr == SOAP_OK) {
-#if DEBUG
-			cout << "current tick: " << getStatus_resp.return_->currentTick << endl;
-#endif
-			soap_timer.stop();
-			stat_getstatus.push((double)soap_timer.get_milliseconds());
-			repeated_tick = true;
-			if (lasttick != getStatus_resp.return_->currentTick) {
-				//OK, we got a new tick.
-				lasttick = state->tickno;
-				state->tickno = getStatus_resp.return_->currentTick;
-				repeated_tick = false;
-				if (lasttick + 1 == state->tickno) {
-					skipped_tick = false;
-				} else {
-					skipped_tick = true;
-				}
-			}
-			if (!state_synced) {
-				if (getStatus_resp.return_->playerName) {
-					myname = (*getStatus_resp.return_->playerName);
+	size_t k;
+	if (!state_synced) {
+		if (frame.named) {
+			myname = frame.player_name;
 #if DEBUG > 1
-					cout << "my name: " << myname << endl;
+			cout << "my name: " << myname << endl;
 #endif
-				}
-				//Re-init all the unit values
-				for (i = 0; i < 4;i++) {
-					state->tank[i].active = 0;
-					state->bullet[i].active = 0;
-				}
-			}
-			/* ignoring getStatus_resp.return_->nextTickTime hopefully */
-			for (vector<ns1__player*>::iterator player = getStatus_resp.return_->players.begin(); player != getStatus_resp.return_->players.end(); ++player) {
-				its_me = false;
+		}
+		//Re-init all the unit values
+		for (i = 0; i < 4;i++) {
+			state->tank[i].active = 0;
+			state->bullet[i].active = 0;
+		}
+	}
+	if (frame.num_players > STATUS_PLAYERS) {
+		cerr << "Warning: Received more than two players!" << endl;
+	}
+	for (k = 0; k < (size_t)min(frame.num_players,STATUS_PLAYERS); k++) {
+		StatusPlayer& player = frame.player[k];
+		its_me = false;
 #if DEBUG > 1
-				cout << "Player: ";
+		cout << "Player: ";
 #endif
-				if ((*player)->name) {
+		if (player.named) {
 #if DEBUG > 1
-					cout << (*(*player)->name);
+			cout << player.name;
 #endif
-					if ( (*(*player)->name) == myname) {
-						its_me = true;
-					}
-				} else {
-					cerr << "Warning, received player without name!" << endl;
+			if (player.name == myname) {
+				its_me = true;
+			}
+		} else {
+			cerr << "Warning, received player without name!" << endl;
 #if DEBUG > 1
-					cout << "(anonymous)";
+			cout << "(anonymous)";
 #endif
-				}
+		}
 
-				player_offset = its_me ? 0 : 2;
+		player_offset = its_me ? 0 : 2;
 
 #if DEBUG > 1
-				cout << endl;
+		cout << endl;
 #endif
-				if (!state_synced && (*player)->base) {
+		if (!state_synced && player.based) {
 #if DEBUG > 1
-					cout << "-- base at (" << (*player)->base->x << "," << (*player)->base->y << ")" << endl;
+			cout << "-- base at (" << player.base_x << "," << player.base_y << ")" << endl;
 #endif
-					state->base[player_offset/2].x = (*player)->base->x;
-					state->base[player_offset/2].y = (*player)->base->y;
-				}
-
-				num_recv = 0;
+			state->base[player_offset/2].x = player.base_x;
+			state->base[player_offset/2].y = player.base_y;
+		}
 
-				for (vector<ns1__unit*>::iterator unit_iter = (*player)->units.begin(); unit_iter != (*player)->units.end(); ++unit_iter) {
-					if ((*unit_iter)) {
-						ns1__unit& unit = (*(*unit_iter));
+		received_tanks = player.unit;
+		num_recv = min(player.num_units,STATUS_UNITS);
 #if DEBUG
-						cout << "--" << "unit [" << unit.id << "] at (" << unit.x << "," << unit.y << ")";
-						if (unit.direction) {
-							cout << " o: " << (*unit.direction);
-						}
-						if (unit.action) {
-							cout << " a: " << (*unit.action);
-						}
-						cout << endl;
+		for (i = 0; i < num_recv; i++) {
+			cout << "--" << "unit [" << received_tanks[i].id << "] at (" << received_tanks[i].x << "," << received_tanks[i].y << ")";
+			cout << " o: " << o2str(received_tanks[i].o) << endl;
+		}
 #endif
-						received_tanks[num_recv].id = unit.id;
-						received_tanks[num_recv].x = unit.x;
-						received_tanks[num_recv].y = unit.y;
-						received_tanks[num_recv].active = 1;
-						received_tanks[num_recv].tag = 0;
-						received_tanks[num_recv].o = ntoh_direction(unit.direction);
-
-						if (num_recv < 2) {
-							num_recv++;
-						} else {
-							//assume that they might be sending more tanks; ignore them
-							cerr << "Warning: Received more than two tanks for a player!" << endl;
-							state_synced = false;
-						}
-					}
-				}
+		if (player.num_units > STATUS_UNITS) {
+			//assume that they might be sending more tanks; ignore them
+			cerr << "Warning: Received more than two tanks for a player!" << endl;
+			state_synced = false;
+		}
 
-				if (!state_synced) {
+		if (!state_synced) {
 #if DEBUG > 1
-					cout << "Syncing tanks" << endl;
+			cout << "Syncing tanks" << endl;
 #endif
-					for (i = 0; i < num_recv; i++) {
-						state->tank[i+player_offset] = received_tanks[i];
-					}
-				} else {
-					// Clear active tanks
-					for (i = 0; i < 2; i++) {
-						state->tank[i+player_offset].active = 0;
-					}
-					check = 0;
-					// Compare tank ID's, if they match, copy over new data
-					for (i = 0; i < num_recv; i++) {
-						for (j = 0; j < 2; j++) {
-							if (state->tank[j+player_offset].id == received_tanks[i].id) {
-								state->tank[j+player_offset] = received_tanks[i];
-								check++;
-							}
-						}
-					}
-					if (check != num_recv) {
-						cerr << "Warning, ID of tank suddenly changed!" << endl;
-						for (i = 0; i < num_recv; i++) {
-							state->tank[i+player_offset] = received_tanks[i];
-						}
-						state_synced = false;
+			for (i = 0; i < num_recv; i++) {
+				state->tank[i+player_offset] = received_tanks[i];
+			}
+		} else {
+			// Clear active tanks
+			for (i = 0; i < 2; i++) {
+				state->tank[i+player_offset].active = 0;
+			}
+			check = 0;
+			// Compare tank ID's, if they match, copy over new data
+			for (i = 0; i < num_recv; i++) {
+				for (j = 0; j < 2; j++) {
+					if (state->tank[j+player_offset].id == received_tanks[i].id) {
+						state->tank[j+player_offset] = received_tanks[i];
+						check++;
 					}
 				}
+			}
+			if (check != num_recv) {
+				cerr << "Warning, ID of tank suddenly changed!" << endl;
+				for (i = 0; i < num_recv; i++) {
+					state->tank[i+player_offset] = received_tanks[i];
+				}
+				state_synced = false;
+			}
+		}
 
 
-				num_recv = 0;
-				for (vector<ns1__bullet*>::iterator bullet_iter = (*player)->bullets.begin(); bullet_iter != (*player)->bullets.end(); ++bullet_iter) {
-					ns1__bullet& bullet = (*(*bullet_iter));
+		received_bullets = player.bullet;
+		num_recv = min(player.num_bullets,STATUS_UNITS);
 #if DEBUG
-					cout << "--" << " bullet [" << bullet.id << "] at (" << bullet.x << "," << bullet.y << ")";
-					cout << " o: " << (*bullet.direction);
-#endif
-					received_bullets[num_recv].active = 1;
-					received_bullets[num_recv].id = bullet.id;
-					received_bullets[num_recv].x = bullet.x;
-					received_bullets[num_recv].y = bullet.y;
-					received_bullets[num_recv].o = ntoh_direction(bullet.direction);
-
-					if (num_recv < 2) {
-						num_recv++;
-					} else {
-						//assume that they might be sending more tanks; ignore them
-						cerr << "Warning: Received more than two bullets for a player!" << endl;
-						state_synced = false;
-					}
-#if DEBUG
-					cout << endl;
+		for (i = 0; i < num_recv; i++) {
+			cout << "--" << " bullet [" << received_bullets[i].id << "] at (" << received_bullets[i].x << "," << received_bullets[i].y << ")";
+			cout << " o: " << o2str(received_bullets[i].o) << endl;
+		}
 #endif
-				}
+		if (player.num_bullets > STATUS_UNITS) {
+			//assume that they might be sending more bullets; ignore them
+			cerr << "Warning: Received more than two bullets for a player!" << endl;
+			state_synced = false;
+		}
 
-				if (!state_synced) {
+		if (!state_synced) {
 #if DEBUG > 1
-					cout << "Syncinc bullets" << endl;
-#endif
-					for (i = player_offset; i < 2+player_offset; i++) {
-						//Unassociate bullets
-						state->bullet[i].o = 0;
-						state->bullet[i].x = 0;
-						state->bullet[i].y = 0;
-						state->bullet[i].id = INT_MAX;
-					}
-				}
+			cout << "Syncinc bullets" << endl;
+#endif
+			for (i = player_offset; i < 2+player_offset; i++) {
+				//Unassociate bullets
+				state->bullet[i].o = 0;
+				state->bullet[i].x = 0;
+				state->bullet[i].y = 0;
+				state->bullet[i].id = INT_MAX;
+			}
+		}
 
-				// Clear active bullets
-				for (i = player_offset; i < 2+player_offset; i++) {
-					state->bullet[i].active = 0;
-				}
+		// Clear active bullets
+		for (i = player_offset; i < 2+player_offset; i++) {
+			state->bullet[i].active = 0;
+		}
 
-				check = 0;
-				// Compare bullet ID's, if they match, copy over new data
-				for (i = 0; i < num_recv; i++) {
-					for (j = player_offset; j < 2+player_offset; j++) {
-						if (state->bullet[j].id == received_bullets[i].id) {
-							state->bullet[j] = received_bullets[i];
-							received_bullets[i].active = 0;
-							check++;
-						}
-					}
+		check = 0;
+		// Compare bullet ID's, if they match, copy over new data
+		for (i = 0; i < num_recv; i++) {
+			for (j = player_offset; j < 2+player_offset; j++) {
+				if (state->bullet[j].id == received_bullets[i].id) {
+					state->bullet[j] = received_bullets[i];
+					received_bullets[i].active = 0;
+					check++;
 				}
-				if (check < num_recv) {
-					//There are new bullets on the field!
-					if ((check == 1) && (num_recv == 2)) {
-						//Special case: one bullet has already been tagged
-						//We know who fired it then.
-						if (received_bullets[0].active) {
-							j = 0;
-						} else {
-							j = 1;
-						}
-						for (i = player_offset; i < 2+player_offset; i++) {
-							if (!state->bullet[i].active) {
+			}
+		}
+		if (check < num_recv) {
+			//There are new bullets on the field!
+			if ((check == 1) && (num_recv == 2)) {
+				//Special case: one bullet has already been tagged
+				//We know who fired it then.
+				if (received_bullets[0].active) {
+					j = 0;
+				} else {
+					j = 1;
+				}
+				for (i = player_offset; i < 2+player_offset; i++) {
+					if (!state->bullet[i].active) {
 #if DEBUG > 1
-								cout << "Associated bullet id(" << received_bullets[j].id << ") with tank id(" << state->tank[i].id <<") by elimination" << endl;
+						cout << "Associated bullet id(" << received_bullets[j].id << ") with tank id(" << state->tank[i].id <<") by elimination" << endl;
 #endif
-								state->bullet[i] = received_bullets[j];
-							}
-						}
-					} else {
-						//We have to backtrack
-						for (i = 0; i < num_recv; i++) {
-							int b_x,b_y,x,y,t;
-							bool found = false;
-							if (received_bullets[i].active) {
-								b_x = received_bullets[i].x;
-								b_y = received_bullets[i].y;
-								switch (received_bullets[i].o) {
-								case O_LEFT:
-									for (x = (b_x+3); x < state->max_x-2 && !found; x++) {
-										t = (x-(b_x+3))/2;
-										for (y = max((b_y-t),2); y <= min((b_y+t),state->max_y-2) && !found;y++) {
-											for (j = player_offset; j < player_offset+2 && !found; j++) {
-												found = state->isTankAt(j,x,y);
-											}
-										}
+						state->bullet[i] = received_bullets[j];
+					}
+				}
+			} else {
+				//We have to backtrack
+				for (i = 0; i < num_recv; i++) {
+					int b_x,b_y,x,y,t;
+					bool found = false;
+					if (received_bullets[i].active) {
+						b_x = received_bullets[i].x;
+						b_y = received_bullets[i].y;
+						switch (received_bullets[i].o) {
+						case O_LEFT:
+							for (x = (b_x+3); x < state->max_x-2 && !found; x++) {
+								t = (x-(b_x+3))/2;
+								for (y = max((b_y-t),2); y <= min((b_y+t),state->max_y-2) && !found;y++) {
+									for (j = player_offset; j < player_offset+2 && !found; j++) {
+										found = state->isTankAt(j,x,y);
 									}
-									break;
-								case O_RIGHT:
-
-									for (x = (b_x-3); x > 2 && !found; x--) {
-										t = ((b_x-3)-x)/2;
-										for (y = max((b_y-t),2); y <= min((b_y+t),state->max_y-2) && !found;y++) {
-											for (j = player_offset; j < player_offset+2 && !found; j++) {
-												found = state->isTankAt(j,x,y);
-											}
-										}
+								}
+							}
+							break;
+						case O_RIGHT:
+
+							for (x = (b_x-3); x > 2 && !found; x--) {
+								t = ((b_x-3)-x)/2;
+								for (y = max((b_y-t),2); y <= min((b_y+t),state->max_y-2) && !found;y++) {
+									for (j = player_offset; j < player_offset+2 && !found; j++) {
+										found = state->isTankAt(j,x,y);
 									}
-									break;
-								case O_DOWN:
-									for (y = (b_y-3); y > 2 && !found; y--) {
-										t = ((b_y-3)-y)/2;
-										for (x = max((b_x-t),2); x <= min((b_x+t),state->max_x-2) && !found;x++) {
-											for (j = player_offset; j < player_offset+2 && !found; j++) {
-												found = state->isTankAt(j,x,y);
-											}
-										}
+								}
+							}
+							break;
+						case O_DOWN:
+							for (y = (b_y-3); y > 2 && !found; y--) {
+								t = ((b_y-3)-y)/2;
+								for (x = max((b_x-t),2); x <= min((b_x+t),state->max_x-2) && !found;x++) {
+									for (j = player_offset; j < player_offset+2 && !found; j++) {
+										found = state->isTankAt(j,x,y);
 									}
-									break;
-								default:
-								case O_UP:
-									for (y = (b_y+3); y < state->max_y-2 && !found; y++) {
-										t = (y-(b_y+3))/2;
-										for (x = max((b_x-t),2); x <= min((b_x+t),state->max_x-2) && !found;x++) {
-											for (j = player_offset; j < player_offset+2 && !found; j++) {
-												found = state->isTankAt(j,x,y);
-											}
-										}
+								}
+							}
+							break;
+						default:
+						case O_UP:
+							for (y = (b_y+3); y < state->max_y-2 && !found; y++) {
+								t = (y-(b_y+3))/2;
+								for (x = max((b_x-t),2); x <= min((b_x+t),state->max_x-2) && !found;x++) {
+									for (j = player_offset; j < player_offset+2 && !found; j++) {
+										found = state->isTankAt(j,x,y);
 									}
-									break;
 								}
-								if (found)
-								{
-									j--;
+							}
+							break;
+						}
+						if (found)
+						{
+							j--;
 #if DEBUG > 1
-									cout << "Associated bullet id(" << received_bullets[i].id << ") with tank id(" << state->tank[j].id <<") by backtracking" << endl;
+							cout << "Associated bullet id(" << received_bullets[i].id << ") with tank id(" << state->tank[j].id <<") by backtracking" << endl;
 #endif
-									state->bullet[j] = received_bullets[i];
-									received_bullets[i].active = 0;
-								} else {
-									//Orphaned bullet: look for an inactive tank
-									for (j = player_offset; j < 2+player_offset; j++) {
-										if ((!state->tank[j].active) && (!state->bullet[j].active)) {
+							state->bullet[j] = received_bullets[i];
+							received_bullets[i].active = 0;
+						} else {
+							//Orphaned bullet: look for an inactive tank
+							for (j = player_offset; j < 2+player_offset; j++) {
+								if ((!state->tank[j].active) && (!state->bullet[j].active)) {
 #if DEBUG > 1
-											cout << "Associated bullet id(" << received_bullets[i].id << ") with orphan" << endl;
+									cout << "Associated bullet id(" << received_bullets[i].id << ") with orphan" << endl;
 #endif
-											state->bullet[j] = received_bullets[i];
-											received_bullets[i].active = 0;
-											break;
-										}
-									}
+									state->bullet[j] = received_bullets[i];
+									received_bullets[i].active = 0;
+									break;
 								}
 							}
 						}
 					}
 				}
+			}
+		}
 
-				for (i = 0; i < 2; i++) {
-					if (!state->bullet[i].active) {
-						state->bullet[i].id = INT_MAX;
-					}
-				}
+		for (i = 0; i < 2; i++) {
+			if (!state->bullet[i].active) {
+				state->bullet[i].id = INT_MAX;
+			}
+		}
 
 #if DEBUG > 1
-				cout << "-=end Player=-" << endl;
+		cout << "-=end Player=-" << endl;
 #endif
-			}
+	}
 
-			if (!state_synced) {
-				pair<int,int> tank_and_id;
-				vector< pair<int,int> > tanks_and_ids(4);
-				for (i = 0; i < 4; i++) {
-					tank_and_id.first = i;
-					tank_and_id.second = state->tank[i].id;
-					tanks_and_ids[i] = tank_and_id;
-				}
-				sort(tanks_and_ids.begin(), tanks_and_ids.end(), sort_pair_second<int, int>());
-				for (i = 0; i < 4; i++) {
-					state->tank_priority[i] = tanks_and_ids[i].first;
-				}
-			}
+	if (!state_synced) {
+		pair<int,int> tank_and_id;
+		vector< pair<int,int> > tanks_and_ids(4);
+		for (i = 0; i < 4; i++) {
+			tank_and_id.first = i;
+			tank_and_id.second = state->tank[i].id;
+			tanks_and_ids[i] = tank_and_id;
+		}
+		sort(tanks_and_ids.begin(), tanks_and_ids.end(), sort_pair_second<int, int>());
+		for (i = 0; i < 4; i++) {
+			state->tank_priority[i] = tanks_and_ids[i].first;
+		}
+	}
 
-			if (getStatus_resp.return_->events) {
+	if (frame.has_events) {
 #if DEBUG > 1
-				cout << "Events:" << endl;
+		cout << "Events:" << endl;
 #endif
-				for (vector<ns1__blockEvent*>::iterator block_event_iter = getStatus_resp.return_->events->blockEvents.begin(); block_event_iter != getStatus_resp.return_->events->blockEvents.end(); ++block_event_iter) {
-					ns1__blockEvent &block_event = *(*block_event_iter);
+		for (k = 0; k < frame.blocks.size(); k++) {
+			BlockDelta& block = frame.blocks[k];
 #if DEBUG > 1
-					cout << "-- block";
-					cout << " at (" << block_event.point->x << "," << block_event.point->y << ")";
-					cout << " new state " << (*block_event.newState);
-					cout << endl;
-#endif
-					if (block_event.point && block_event.newState) {
-						switch (*block_event.newState) {
-						case ns1__state__FULL:
-							//WTF, walls suddenly appeared?!?!?
-							state->board[block_event.point->x][block_event.point->y] |= B_WALL;
-							break;
-						case ns1__state__NONE:
-						case ns1__state__EMPTY:
-							//Walls got destroyed
-							state->board[block_event.point->x][block_event.point->y] |= B_WALL;
-							state->board[block_event.point->x][block_event.point->y] ^= B_WALL;
-							break;
-						case ns1__state__OUT_USCOREOF_USCOREBOUNDS:
-							//Endgame
-							state->board[block_event.point->x][block_event.point->y] |= B_OOB;
-							break;
-						}
-					}
-				}
-#if 0
-				//For now, ignore unit events that happened in the past.
-				for (vector<ns1__unitEvent*>::iterator unit_event = getStatus_resp.return_->events->unitEvents.begin(); unit_event != getStatus_resp.return_->events->unitEvents.end(); ++unit_event) {
-					cout << "-- event @(" << (*unit_event)->tickTime << ")";
-					if ((*unit_event)->unit) {
-						ns1__unit& unit = (*(*unit_event)->unit);
-						cout << " {unit [" << unit.id << "] at (" << unit.x << "," << unit.y << ")";
-						if (unit.direction) {
-							cout << " o: " << (*unit.direction);
-						}
-						if (unit.action) {
-							cout << " a: " << (*unit.action);
-						}
-						cout << "}";
-					}
-					if ((*unit_event)->bullet) {
-						ns1__bullet& bullet = (*(*unit_event)->bullet);
-						cout << " {bullet [" << bullet.id << "] at (" << bullet.x << "," << bullet.y << ")";
-						if (bullet.direction) {
-							cout << " o: " << (*bullet.direction);
-						}
-						cout << "}";
-					}
-					cout << endl;
+			cout << "-- block";
+			cout << " at (" << block.x << "," << block.y << ")";
+			cout << " new state " << block.newstate;
+			cout << endl;
+#endif
+			if (block.x >= 0 && block.x < state->board.width
+					&& block.y >= 0 && block.y < state->board.height) {
+				switch (block.newstate) {
+				case ns1__state__FULL:
+					//WTF, walls suddenly appeared?!?!?
+					state->board[block.x][block.y] |= B_WALL;
+					break;
+				case ns1__state__NONE:
+				case ns1__state__EMPTY:
+					//Walls got destroyed
+					state->board[block.x][block.y] |= B_WALL;
+					state->board[block.x][block.y] ^= B_WALL;
+					break;
+				case ns1__state__OUT_USCOREOF_USCOREBOUNDS:
+					//Endgame
+					state->board[block.x][block.y] |= B_OOB;
+					break;
 				}
+			}
+		}
+#if DEBUG > 1
+		cout << "-=end Events=-" << endl;
 #endif
+	} //if events
+
+	state_synced = true;
+}
+
+//Milliseconds on clock since its restart(), without stopping it for good
+static double elapsedMs(platformstl::performance_counter& clock)
+{
+	clock.stop();
+	return (double)clock.get_microseconds()/1000.0;
+}
+
+//The I/O thread: polls getStatus, decodes it into state and hands that to the
+//search, then sends whatever the search has settled on at the deadline.
+//Nothing in here waits on the search. TickTimer picks the deadline from the
+//latencies seen so far.
+void NetworkCore::ioLoop()
+{
+	TickTimer timer;
+	platformstl::performance_counter clock; //ms since the loop started, see elapsedMs
+	double polled_at,received_at,decoded_at,send_at,tick_ends,next_poll,submit_start;
+	StatusFrame frame;
 #if DEBUG > 1
-				cout << "-=end Events=-" << endl;
+	int i;
+#endif
+	bool repeated_tick;
+	bool batch_actions = true; //Cleared if the server keeps rejecting setActions
+	int batch_faults = 0; //In a row
+	int num_batched = 0;
+	int num_unbatched = 0;
+	int num_unready = 0;
+	int num_late = 0;
+	int num_skipped = 0;
+#if SAVESTARTMAP
+	bool firstrun = true;
 #endif
-			} //if events
 
-			//TODO: check for cases when state is NOT synced!
-			if (!state_synced) {
-				mc_tree->init(state);
-			} else {
-				mc_tree->init(state);
+	clock.restart();
+	while (soaperr == SOAP_OK) {
+		polled_at = elapsedMs(clock);
+		soaperr = fetchStatus(frame);
+		received_at = elapsedMs(clock);
+		timer.getstatus.push(received_at-polled_at);
+		if (soaperr == SOAP_OK) {
+#if DEBUG
+			cout << "current tick: " << frame.tick << endl;
+#endif
+			repeated_tick = true;
+			if (!state_synced || state->tickno != frame.tick) {
+				//OK, we got a new tick.
+				if (state_synced && frame.tick > state->tickno+1) {
+					num_skipped += frame.tick-state->tickno-1;
+				}
+				state->tickno = frame.tick;
+				repeated_tick = false;
 			}
-			state_synced = true;
+			syncStatus(frame);
 #if SAVESTARTMAP
 			if (firstrun) {
 				firstrun = false;
@@ -608,95 +1316,286 @@ void NetworkCore::play()
 #endif
 
 #if DEBUG > 1
-			cout << "milliseconds to next tick: " << getStatus_resp.return_->millisecondsToNextTick << endl;
+			cout << "milliseconds to next tick: " << frame.ms_to_next << endl;
 #endif
-			nexttick = getStatus_resp.return_->millisecondsToNextTick;
-			if (nexttick < 0) {
-				skipped_tick = false;
+			if (frame.ms_to_next < 0) {
+				//The server is between ticks
 				repeated_tick = true;
 			} else {
-				if (nexttick < safety_margin) {
-					repeated_tick = false;
-					skipped_tick = true;
+				timer.tick_length = max(timer.tick_length,(double)frame.ms_to_next);
+			}
+		} else {
+			s.soap_stream_fault(std::cerr);
+			recycle();
+			cout << "looping back" << endl;
+			continue;
+		}
+		recycle();
+
+#if DEBUG > 1
+		cout << "GetStatus [" << received_at-polled_at << " ms] [p50: " << timer.getstatus.quantile(0.5) << " ms]" << endl;
+#endif
+		if (repeated_tick) {
+			//Polled before the server moved on, try again shortly
+#if DEBUG > 1
+			cout << "Repeated tick!" << endl;
+#endif
+			Sleep((uint32_t)timer.retryDelay());
+			continue;
+		}
+
+		//The server read its clock somewhere between polled_at and received_at.
+		//Sending is timed off the earliest the tick can end, polling for the
+		//next one off the latest.
+		tick_ends = polled_at+frame.ms_to_next;
+		next_poll = received_at+frame.ms_to_next;
+		publishState();
+		decoded_at = elapsedMs(clock);
+		timer.decode.push(decoded_at-received_at);
+		send_at = tick_ends-timer.sendBudget();
+		if (send_at < decoded_at) {
+			//Not enough of the tick left to get actions in
+			cerr << "Too late for tick " << state->tickno << ", waiting for the next one" << endl;
+			num_late++;
+			if (next_poll > decoded_at) {
+				Sleep((uint32_t)(next_poll-decoded_at));
+			}
+			continue;
+		}
+#if DEBUG > 1
+		cout << "Sending at [" << tick_ends << "-" << timer.sendBudget() << " ms], " << send_at-decoded_at << " ms from now" << endl;
+#endif
+		if (soaperr == SOAP_OK) {
+			int tankid;
+			ns1__setAction setAction_req;
+			ns1__setActionResponse setAction_resp;
+			ns1__setActions setActions_req;
+			ns1__setActionsResponse setActions_resp;
+			ns1__action action[2];
+			bool sent;
+			double ms_to_next = -1.0;
+			//The search has the window to itself
+			Sleep((uint32_t)(send_at-decoded_at));
+
+#if DEBUG > 1
+			cout << "Finished delaying, next tick should be imminent!" << endl;
+#endif
+			if (!takeAction(state->tickno,action)) {
+				//Don't resend last tick's actions
+				cerr << "No actions ready for tick " << state->tickno << "!" << endl;
+				action[0] = ns1__action__NONE;
+				action[1] = ns1__action__NONE;
+				num_unready++;
+			}
+#if DEBUG > 1
+			cout << "AI chose";
+			for (i = 0; i < 2; i++) {
+				if (state->tank[i].active) {
+					cout << " tank[" << i << "]: " << action2str(action[i]);
+				}
+			}
+			cout << endl;
+#endif
+			//Both tanks' actions go out in one setActions round-trip. The server
+			//takes arg0/arg1 in the order it lists our units, which is the order
+			//tank[0] and tank[1] were synced in. A lone tank, or a server that
+			//won't take setActions, gets a setAction per tank instead.
+			submit_start = elapsedMs(clock);
+			sent = false;
+			if (batch_actions && state->tank[0].active && state->tank[1].active) {
+				setActions_req.arg0 = &action[0];
+				setActions_req.arg1 = &action[1];
+				soaperr = s.setActions(&setActions_req,&setActions_resp);
+				if (soaperr == SOAP_OK) {
+					if (setActions_resp.return_) {
+						ms_to_next = (double)setActions_resp.return_->millisecondsToNextTick;
+					}
+					sent = true;
+					num_batched++;
+					batch_faults = 0;
+				} else {
+					s.soap_stream_fault(std::cerr);
+					//A server without setActions faults on every one of them,
+					//a single fault could just as well be a bad tick
+					if (soap_soap_error_check(soaperr) || soap_xml_error_check(soaperr) || soap_http_error_check(soaperr)) {
+						batch_faults++;
+					}
+					if (batch_faults >= BATCH_MAX_FAULTS) {
+						cerr << "Warning: setActions was rejected " << batch_faults << " times in a row, sending actions per tank from now on" << endl;
+						batch_actions = false;
+					}
+				}
+				recycle();
+			}
+			if (!sent) {
+				for (tankid = 0; tankid < 2; tankid++) {
+					if (state->tank[tankid].active) {
+						setAction_req.arg0 = state->tank[tankid].id;
+						setAction_req.arg1 = &action[tankid];
+						soaperr = s.setAction(&setAction_req,&setAction_resp);
+						if (soaperr == SOAP_OK) {
+							if (setAction_resp.return_) {
+								ms_to_next = (double)setAction_resp.return_->millisecondsToNextTick;
+							}
+						} else {
+							s.soap_stream_fault(std::cerr);
+						}
+						recycle();
+					}
 				}
+				num_unbatched++;
 			}
-		} else {
-			repeated_tick = false;
-			skipped_tick = false;
-			s.soap_stream_fault(std::cerr);
-			s.destroy();
-			cout << "looping back" << endl;
-			continue;
-		}
-		s.destroy();
-		comms_timer.stop();
-
-#if DEBUG > 1
-		cout << "GetStatus [" << soap_timer.get_milliseconds() << " ms] [avg: " << stat_getstatus.mean() << " ms]" << endl;
-		cout << "full processing time was [" << comms_timer.get_milliseconds() << " ms] " << endl;
-#endif
-		if (repeated_tick) {
-			//Wait a little bit longer next time;
-			settle_time += settle_time/4;
-#if DEBUG > 1
-			cout << "Repeated tick!" << endl;
-			cout << "settle_time now: " << settle_time << endl;
-#endif
-			Sleep((uint32_t)settle_time/2);
-			continue;
-		}
-		if (skipped_tick) {
-			if (nexttick < safety_margin) {
-				settle_time -= settle_time/4;
+			timer.submit.push(elapsedMs(clock)-submit_start);
 #if DEBUG > 1
-				cout << "Missed a tick!" << endl;
-				cout << "settle_time now: " << settle_time << endl;
+			cout << "Submitted actions [p50: " << timer.submit.quantile(0.5) << " ms] [" << num_batched << " batched, " << num_unbatched << " per tank]" << endl;
 #endif
-				if (nexttick+settle_time > 0) {
-					Sleep((uint32_t)nexttick+settle_time);
-				}
-				continue;
+			if (ms_to_next >= 0.0 && timer.sent(next_poll-submit_start,ms_to_next)) {
+				cerr << "Actions for tick " << state->tickno << " arrived after it ended!" << endl;
+			}
+			//From here on it's pondering time!
+			decoded_at = elapsedMs(clock);
+			if (next_poll > decoded_at) {
+				Sleep((uint32_t)(next_poll-decoded_at));
 			}
 		}
+	}
+	timer.report();
+	cout << "Actions went out " << num_batched << " times batched, " << num_unbatched << " per tank" << endl;
+	if (num_late || num_skipped) {
+		cout << num_late << " ticks were too short to act on, " << num_skipped << " went by unseen" << endl;
+	}
+	if (num_unready) {
+		cout << num_unready << " ticks had no actions ready in time" << endl;
+	}
+	handoff_mutex.lock();
+	playing = false;
+	handoff_mutex.unlock();
+}
 
-		//At this point, we should be synced, settled and have a window to do work
-		int64_t window = nexttick-comms_timer.get_milliseconds()-safety_margin;
-#if DEBUG > 1
-		cout << "Expecting next tick at [" << nexttick << "-" << comms_timer.get_milliseconds() << "-" << safety_margin << " ms] = " << window  << " ms"<< endl;
+void NetworkCore::ioThread(void* param)
+{
+	NetworkCore* core = (NetworkCore*)param;
+	if (core->replay_calls) {
+		core->replayLoop();
+	} else {
+		core->ioLoop();
+	}
+}
+
+//The handoff is a triple buffer: the I/O thread decodes into state, copies
+//that into spare and swaps spare with handoff; the search swaps handoff with
+//its own copy. The mutex is only ever held for the swap.
+void NetworkCore::publishState()
+{
+	*spare = *state;
+	handoff_mutex.lock();
+	swap(spare,handoff);
+	handoff_fresh = true;
+	handoff_mutex.unlock();
+}
+
+bool NetworkCore::takeState(PlayoutState*& mine)
+{
+	bool fresh;
+	handoff_mutex.lock();
+	fresh = handoff_fresh;
+	if (fresh) {
+		swap(mine,handoff);
+		handoff_fresh = false;
+	}
+	handoff_mutex.unlock();
+	return fresh;
+}
+
+void NetworkCore::publishAction(int tickno, const ns1__action action[2])
+{
+	handoff_mutex.lock();
+	best_tick = tickno;
+	best_action[0] = action[0];
+	best_action[1] = action[1];
+	handoff_mutex.unlock();
+}
+
+//False if the search hasn't got anything for tickno yet
+bool NetworkCore::takeAction(int tickno, ns1__action action[2])
+{
+	bool ready;
+	handoff_mutex.lock();
+	ready = (best_tick == tickno);
+	if (ready) {
+		action[0] = best_action[0];
+		action[1] = best_action[1];
+	}
+	handoff_mutex.unlock();
+	return ready;
+}
+
+bool NetworkCore::isPlaying()
+{
+	bool p;
+	handoff_mutex.lock();
+	p = playing;
+	handoff_mutex.unlock();
+	return p;
+}
+
+//Runs the search on the calling thread while ioLoop runs on its own. Every
+//new state restarts the tree; in between, the best actions so far are
+//published every SEARCH_PUBLISH_MS for ioLoop to pick up at the deadline.
+void NetworkCore::play()
+{
+	MCTree* mc_tree = new MCTree;
+	PlayoutState* node_state = new PlayoutState;
+	PlayoutState* current = new PlayoutState;
+	platformstl::performance_counter publish_timer;
+	tree_size_t node_id;
+	vector<Move> path;
+	vector<double> results;
+	unsigned char width = 3;
+	unsigned int alpha;
+	uint32_t linear;
+	int greedycmd[2];
+	ns1__action action[2];
+	int tankid,iterations = 0;
+#if DEBUG
+	int i;
 #endif
-		if (soaperr == SOAP_OK) {
-			ai_timer.restart();
-			loop_timer.restart();
-			int64_t looptime;
-			int64_t sleeptime;
-			int tankid;
-			ns1__setAction setAction_req;
-			ns1__setActionResponse setAction_resp;
-			ns1__setActions setActions_req;
-			ns1__setActionsResponse setActions_resp;
-			ns1__action action[2];
-			tree_size_t node_id;
-			vector<Move> path;
-			vector<double> results;
-			unsigned char width = 3;
-			unsigned int alpha;
-			int greedycmd[2];
+	bool searching = false;
+	StatCounter stat_iterations;
+
+	spare = new PlayoutState;
+	handoff = new PlayoutState;
+	handoff_fresh = false;
+	best_tick = -1;
+	playing = true;
+	stat_iterations.init();
+	tthread::thread io_thread(ioThread,this);
+
+	while (isPlaying()) {
+		if (takeState(current)) {
+			if (searching) {
+				stat_iterations.push(iterations);
+			}
+			iterations = 0;
+			mc_tree->init(current);
 #if DEBUG
 			mc_tree->root_state->paint();
 #endif
-			sleeptime = safety_margin;
-
+			action[0] = ns1__action__NONE;
+			action[1] = ns1__action__NONE;
+			searching = false;
 			switch (policy) {
 			case POLICY_MCTS:
 			case POLICY_GREEDY:
-				//state->paint(*u);
+				//current->paint(*u);
 				greedycmd[0] = C_NONE;
 				greedycmd[1] = C_NONE;
 				for (tankid = 0; tankid < 2; tankid++) {
-					if (state->tank[tankid].active) {
+					if (current->tank[tankid].active) {
 						scored_cmds_t cmds;
-						int bestcmd = mc_tree->root_state->bestCExpensive(tankid,mc_tree->root_u->expensivecost[tankid],mc_tree->root_obstacles[tankid],cmds);
+						int bestcmd = mc_tree->root_state->bestCExpensive(tankid,mc_tree->root_u->expensivecost[tankid],mc_tree->root_obstacles[tankid],mc_tree->root_u->footprint[U_EXPENSIVE(tankid)],cmds);
 #if DEBUG
+						cmds.top(SCORED_CMDS_MAX);
 						cout << "Costs [" << tankid << "]:";
 						for (int c = 0; c < 6; c++) {
 							cout << " " << cmd2str(cmds[c].first) << ": " << cmds[c].second;
@@ -710,8 +1609,8 @@ void NetworkCore::play()
 					}
 				}
 #if HALFLIMP
-				if ((state->tank[2].active+state->tank[3].active) == 0 &&
-						(state->tank[0].active+state->tank[1].active) == 2) {
+				if ((current->tank[2].active+current->tank[3].active) == 0 &&
+						(current->tank[0].active+current->tank[1].active) == 2) {
 #if DEBUG
 					if (policy == POLICY_GREEDY) {
 						cout << "GOING HALF-LIMP!" << endl;
@@ -722,7 +1621,7 @@ void NetworkCore::play()
 #endif
 
 #if AREYOUNUTS
-				if (state->tickno > 55) {
+				if (current->tickno > 55) {
 					cout << "GOING LIMP!" << endl;
 					action[0] = ns1__action__NONE;
 					action[1] = ns1__action__NONE;
@@ -732,74 +1631,13 @@ void NetworkCore::play()
 #if DEBUG
 				cout << "Greedy chose";
 				for (i = 0; i < 2; i++) {
-					if (state->tank[i].active) {
-						cout << " tank[" << i << "]: " << action2str(action[i]);
-					}
-				}
-				cout << endl;
-#endif
-				if (policy == POLICY_GREEDY) {
-					break;
-				}
-
-#if 0
-				cout << "Root node ordering:" << endl;
-				for (i = 0; i < 4; i++) {
-					cout << "tank[" << i << "]{";
-					for (j = 0; j < 6; j++) {
-						cout << " " << cmd2str(mc_tree->tree[mc_tree->root_id].cmd_order[i][j]);
-					}
-					cout << " }" << endl;
-				}
-#endif
-				loop_timer.stop();
-				looptime = loop_timer.get_microseconds();
-				loop_timer.restart();
-				uint32_t linear;
-				while (looptime < (window-50)*1000) {
-					linear = sfmt_genrand_uint32(mc_tree->worker_sfmt[0]) % 10000;
-					if (linear > 8500) {
-						width = 2;
-					} else if (linear > 100) {
-						width = 3;
-					} else if (linear > 10) {
-						width = 4;
-					} else {
-						width = 5;
-					}
-					path.clear();
-					results.clear();
-					memcpy(node_state,mc_tree->root_state,sizeof(PlayoutState));
-					node_id = mc_tree->root_id;
-					mc_tree->select(width,path,node_id,node_state);
-					mc_tree->expand_some(width,node_id,node_state,path,results);
-					mc_tree->backprop(path,results);
-					loop_timer.stop();
-					looptime += loop_timer.get_microseconds();
-					loop_timer.restart();
-				}
-				alpha = mc_tree->best_alpha(C_TO_ALPHA(greedycmd[0],greedycmd[1]));
-
-				action[0] = hton_cmd(C_T0(alpha,0));
-				action[1] = hton_cmd(C_T1(alpha,0));
-#if DEBUG
-				cout << "After MCTS: ";
-				for (i = 0; i < 2; i++) {
-					if (state->tank[i].active) {
+					if (current->tank[i].active) {
 						cout << " tank[" << i << "]: " << action2str(action[i]);
 					}
 				}
 				cout << endl;
 #endif
-#if HALFLIMP
-				if ((state->tank[2].active+state->tank[3].active) == 0 &&
-						(state->tank[0].active+state->tank[1].active) == 2) {
-#if DEBUG
-					cout << "GOING HALF-LIMP!" << endl;
-#endif
-					action[1] = ns1__action__NONE;
-				}
-#endif
+				searching = (policy == POLICY_MCTS);
 				break;
 			default:
 			case POLICY_RANDOM:
@@ -809,81 +1647,565 @@ void NetworkCore::play()
 				break;
 			case POLICY_FIXED:
 				for (tankid = 0; tankid < 2; tankid++) {
-					if (state->tank[tankid].active) {
+					if (current->tank[tankid].active) {
 						int myid = (myname == "Player Two");
-						if (state->tickno < NUMC) {
-							action[tankid] = hton_cmd(fixed_commands[myid][tankid][state->tickno]);
+						if (current->tickno < NUMC) {
+							action[tankid] = hton_cmd(fixed_commands[myid][tankid][current->tickno]);
 						}
 					}
 				}
 				break;
 			}
-			loop_timer.stop();
-			ai_timer.stop();
-			if (ai_timer.get_milliseconds() < window) {
-				window -= ai_timer.get_milliseconds();
-			} else {
-				cerr << "OVERRAN WINDOW!" << endl;
-			}
-#if DEBUG > 1
-			cout << "AI took " << ai_timer.get_milliseconds() << " ms, shortening the window to: " << window << endl;
-			cout << "AI chose";
-			for (i = 0; i < 2; i++) {
-				if (state->tank[i].active) {
-					cout << " tank[" << i << "]: " << action2str(action[i]);
-				}
-			}
-			cout << endl;
-#endif
-			if (window > 0) {
-				Sleep((uint32_t)(window));
-			}
+			publishAction(current->tickno,action);
+			publish_timer.restart();
+			continue;
+		}
+		if (!searching) {
+			Sleep(SEARCH_IDLE_MS);
+			continue;
+		}
+		linear = sfmt_genrand_uint32(mc_tree->worker_sfmt[0]) % 10000;
+		if (linear > 8500) {
+			width = 2;
+		} else if (linear > 100) {
+			width = 3;
+		} else if (linear > 10) {
+			width = 4;
+		} else {
+			width = 5;
+		}
+		path.clear();
+		results.clear();
+		*node_state = *mc_tree->root_state;
+		node_id = mc_tree->root_id;
+		mc_tree->select(width,path,node_id,node_state);
+		mc_tree->expand_some(width,node_id,node_state,path,results);
+		mc_tree->backprop(path,results);
+		iterations++;
+		publish_timer.stop();
+		if (publish_timer.get_milliseconds() < SEARCH_PUBLISH_MS) {
+			continue;
+		}
+		alpha = mc_tree->best_alpha(C_TO_ALPHA(greedycmd[0],greedycmd[1]));
 
+		action[0] = hton_cmd(C_T0(alpha,0));
+		action[1] = hton_cmd(C_T1(alpha,0));
 #if DEBUG > 1
-			cout << "Finished delaying, next tick should be imminent!" << endl;
-#endif
-			for (tankid = 0; tankid < 2; tankid++) {
-				if (state->tank[tankid].active) {
-					setAction_req.arg0 = state->tank[tankid].id;
-					setAction_req.arg1 = &action[tankid];
-					soap_timer.restart();
-					soaperr = s.setAction(&setAction_req,&setAction_resp);
-					soap_timer.stop();
-					stat_setaction.push((double)soap_timer.get_milliseconds());
-					if (soaperr == SOAP_OK) {
-						sleeptime = setAction_resp.return_->millisecondsToNextTick;
-					} else {
-						s.soap_stream_fault(std::cerr);
-					}
-					s.destroy();
-				}
+		cout << "MCTS so far: ";
+		for (i = 0; i < 2; i++) {
+			if (current->tank[i].active) {
+				cout << " tank[" << i << "]: " << action2str(action[i]);
 			}
-#if DEBUG > 1
-			cout << "Last SetAction [" << soap_timer.get_milliseconds() << " ms] [avg: " << stat_setaction.mean() << " ms]" << endl;
-			cout << "Waiting for end of turn in [" << sleeptime << " ms]" << endl;
+		}
+		cout << endl;
 #endif
-			//From here on it's pondering time!
-			if (sleeptime+settle_time > 0 && (sleeptime < safety_margin)) {
-#if DEBUG > 1
-				cout << "setAction was sent in time, waiting for " <<sleeptime+settle_time <<" ms" << endl;
+#if HALFLIMP
+		if ((current->tank[2].active+current->tank[3].active) == 0 &&
+				(current->tank[0].active+current->tank[1].active) == 2) {
+			action[1] = ns1__action__NONE;
+		}
 #endif
-				Sleep((uint32_t)sleeptime+settle_time);
+		publishAction(current->tickno,action);
+		publish_timer.restart();
+	}
+	io_thread.join();
+	if (stat_iterations.count()) {
+		cout << "Search: " << stat_iterations.mean() << " iterations per tick" << endl;
+	}
+	delete spare;
+	delete handoff;
+	delete current;
+	delete mc_tree;
+	delete node_state;
+}
+
+//Per-call getStatus latency, the way play() used to call it (a new
+//connection and malloc'd cells each time) against a kept-alive connection
+//and the arena. The two take turns in rounds; the first call of a round
+//pays for the switch and isn't counted.
+void NetworkCore::benchStatus(int calls)
+{
+	StatCounter stat_getstatus[2];
+	platformstl::performance_counter soap_timer;
+	StatusFrame frame;
+	int i,k,failed = 0;
+	const char* setup[2] = {"new connection, malloc", "kept alive, arena"};
+	stat_getstatus[0].init();
+	stat_getstatus[1].init();
+	for (i = 0; i < 2*calls; i++) {
+		k = (i/BENCHSOAP_ROUND) % 2;
+		if (i % BENCHSOAP_ROUND == 0) {
+			soap_force_closesock(s.soap);
+			if (k) {
+				soap_set_imode(s.soap, SOAP_IO_KEEPALIVE);
+				soap_set_omode(s.soap, SOAP_IO_KEEPALIVE);
+				s.soap->fmalloc = SoapArena::soapMalloc;
 			} else {
-				if (sleeptime > (2*safety_margin)) {
-					safety_margin += safety_margin/4;
-#if DEBUG > 1
-					cout << "setAction was not sent in time!" << endl;
-					cout << "Increasing safety_margin to: " << safety_margin << endl;
-#endif
-				} else {
-#if DEBUG > 1
-					cout << "setAction appears to be sent in time, waiting for " << safety_margin+settle_time << " ms" << endl;
-#endif
-					Sleep((uint32_t)safety_margin+settle_time);
-				}
+				soap_clr_imode(s.soap, SOAP_IO_KEEPALIVE);
+				soap_clr_omode(s.soap, SOAP_IO_KEEPALIVE);
+				s.soap->fmalloc = NULL;
 			}
 		}
+		soap_timer.restart();
+		soaperr = fetchStatus(frame);
+		recycle();
+		soap_timer.stop();
+		if (soaperr != SOAP_OK) {
+			failed++;
+		} else if (i % BENCHSOAP_ROUND != 0) {
+			stat_getstatus[k].push((double)soap_timer.get_microseconds()/1000.0);
+		}
 	}
-	delete mc_tree;
-	delete node_state;
+	for (k = 0; k < 2; k++) {
+		cout << "getStatus, " << setup[k] << ": " << stat_getstatus[k].mean() << " ms (sd "
+				<< sqrt(stat_getstatus[k].variance()) << ") over " << stat_getstatus[k].count() << " calls" << endl;
+	}
+	if (failed) {
+		cout << failed << " calls failed" << endl;
+	}
+	//Back to how play() runs
+	soap_set_imode(s.soap, SOAP_IO_KEEPALIVE);
+	soap_set_omode(s.soap, SOAP_IO_KEEPALIVE);
+	s.soap->fmalloc = SoapArena::soapMalloc;
+	soaperr = SOAP_OK;
+}
+
+//Canned responses for benchDecode, shaped like the server's
+static const char* DECODE_DIRECTION[4] = {"UP", "DOWN", "LEFT", "RIGHT"};
+
+static string decodeEnvelope(const string& body)
+{
+	return "<?xml version=\"1.0\" encoding=\"UTF-8\"?><S:Envelope xmlns:S=\"http://schemas.xmlsoap.org/soap/envelope/\"><S:Body>"
+			+ body + "</S:Body></S:Envelope>";
+}
+
+static string decodeStatusXML(PlayoutState& map)
+{
+	ostringstream out;
+	int i,k,x,y,events = 0;
+	out << "<ns2:getStatusResponse xmlns:ns2=\"http://challenge.entelect.co.za/\"><return><currentTick>"
+			<< map.tickno << "</currentTick>";
+	//A tick's worth of walls coming down
+	out << "<events>";
+	for (x = 0; x < map.max_x && events < 12; x += 3) {
+		for (y = 0; y < map.max_y && events < 12; y += 5) {
+			if (map.board[x][y] == B_WALL) {
+				out << "<blockEvents><newState>EMPTY</newState><point><x>" << x << "</x><y>" << y << "</y></point></blockEvents>";
+				events++;
+			}
+		}
+	}
+	out << "</events><millisecondsToNextTick>1500</millisecondsToNextTick><playerName>Player One</playerName>";
+	for (k = 0; k < 2; k++) {
+		out << "<players><base><x>" << map.base[k].x << "</x><y>" << map.base[k].y << "</y></base>";
+		for (i = 0; i < 2; i++) {
+			if (map.bullet[k*2+i].active) {
+				out << "<bullets><direction>" << DECODE_DIRECTION[map.bullet[k*2+i].o] << "</direction><id>" << map.bullet[k*2+i].id
+						<< "</id><x>" << map.bullet[k*2+i].x << "</x><y>" << map.bullet[k*2+i].y << "</y></bullets>";
+			}
+		}
+		out << "<name>Player " << (k ? "Two" : "One") << "</name>";
+		for (i = 0; i < 2; i++) {
+			if (map.tank[k*2+i].active) {
+				out << "<units><action>NONE</action><direction>" << DECODE_DIRECTION[map.tank[k*2+i].o] << "</direction><id>" << k*2+i+1
+						<< "</id><x>" << map.tank[k*2+i].x << "</x><y>" << map.tank[k*2+i].y << "</y></units>";
+			}
+		}
+		out << "</players>";
+	}
+	out << "</return></ns2:getStatusResponse>";
+	return decodeEnvelope(out.str());
+}
+
+static string decodeBoardXML(PlayoutState& map)
+{
+	ostringstream out;
+	int x,y;
+	out << "<ns2:loginResponse xmlns:ns2=\"http://challenge.entelect.co.za/\"><return><endGamePoint>"
+			<< map.endgame_tick << "</endGamePoint>";
+	for (x = 0; x < map.max_x; x++) {
+		out << "<states>";
+		for (y = 0; y < map.max_y; y++) {
+			out << "<item>" << ((map.board[x][y] & B_WALL) ? "FULL" : (B_ISOOB(map.board[x][y]) ? "OUT_OF_BOUNDS" : "EMPTY")) << "</item>";
+		}
+		out << "</states>";
+	}
+	out << "</return></ns2:loginResponse>";
+	return decodeEnvelope(out.str());
+}
+
+static bool decodeFile(const char* filename, string& xml)
+{
+	ifstream fin(filename, ios::in | ios::binary);
+	ostringstream out;
+	if (!fin) {
+		return false;
+	}
+	out << fin.rdbuf();
+	xml = out.str();
+	return true;
+}
+
+//What s.getStatus and s.login do with the response, for comparison
+static int decodeDOM(struct soap* soap, ns1__getStatusResponse& resp)
+{
+	resp.soap_default(soap);
+	if (soap_begin_recv(soap)
+			|| soap_envelope_begin_in(soap)
+			|| soap_recv_header(soap)
+			|| soap_body_begin_in(soap)) {
+		return soap_closesock(soap);
+	}
+	resp.soap_get(soap, "ns1:getStatusResponse", "ns1:getStatusResponse");
+	if (soap->error) {
+		return soap_recv_fault(soap, 0);
+	}
+	if (soap_body_end_in(soap)
+			|| soap_envelope_end_in(soap)
+			|| soap_end_recv(soap)) {
+		return soap_closesock(soap);
+	}
+	return soap_closesock(soap);
+}
+
+static int decodeDOM(struct soap* soap, ns1__loginResponse& resp)
+{
+	resp.soap_default(soap);
+	if (soap_begin_recv(soap)
+			|| soap_envelope_begin_in(soap)
+			|| soap_recv_header(soap)
+			|| soap_body_begin_in(soap)) {
+		return soap_closesock(soap);
+	}
+	resp.soap_get(soap, "ns1:loginResponse", "ns1:loginResponse");
+	if (soap->error) {
+		return soap_recv_fault(soap, 0);
+	}
+	if (soap_body_end_in(soap)
+			|| soap_envelope_end_in(soap)
+			|| soap_end_recv(soap)) {
+		return soap_closesock(soap);
+	}
+	return soap_closesock(soap);
+}
+
+//Counts the fields where the streamed frame disagrees with the DOM
+static int decodeMismatches(ns1__getStatusResponse& resp, StatusFrame& frame)
+{
+	int mismatches = 0;
+	size_t k,i;
+	ns1__game* game = resp.return_;
+	if (!game) {
+		return 1;
+	}
+	mismatches += (game->currentTick != frame.tick);
+	mismatches += (game->millisecondsToNextTick != frame.ms_to_next);
+	mismatches += ((game->playerName != NULL) != frame.named);
+	mismatches += (game->playerName && frame.named && *game->playerName != frame.player_name);
+	mismatches += ((int)game->players.size() != frame.num_players);
+	for (k = 0; k < min(game->players.size(), (size_t)STATUS_PLAYERS); k++) {
+		ns1__player* player = game->players[k];
+		mismatches += ((int)player->units.size() != frame.player[k].num_units);
+		mismatches += ((int)player->bullets.size() != frame.player[k].num_bullets);
+		mismatches += (player->name && *player->name != frame.player[k].name);
+		for (i = 0; i < min(player->units.size(), (size_t)STATUS_UNITS); i++) {
+			mismatches += (player->units[i]->id != frame.player[k].unit[i].id);
+			mismatches += (player->units[i]->x != frame.player[k].unit[i].x);
+			mismatches += (player->units[i]->y != frame.player[k].unit[i].y);
+			mismatches += (ntoh_direction(player->units[i]->direction) != frame.player[k].unit[i].o);
+		}
+		for (i = 0; i < min(player->bullets.size(), (size_t)STATUS_UNITS); i++) {
+			mismatches += (player->bullets[i]->id != frame.player[k].bullet[i].id);
+			mismatches += (player->bullets[i]->x != frame.player[k].bullet[i].x);
+			mismatches += (player->bullets[i]->y != frame.player[k].bullet[i].y);
+		}
+	}
+	if (game->events) {
+		mismatches += (game->events->blockEvents.size() != frame.blocks.size());
+	}
+	return mismatches;
+}
+
+static int decodeMismatches(ns1__loginResponse& resp, BoardFrame& board)
+{
+	int mismatches = 0;
+	size_t x,y,next = 0;
+	if (!resp.return_) {
+		return 1;
+	}
+	mismatches += (resp.return_->endGamePoint != board.endgame_tick);
+	if (resp.return_->states.size() != board.column.size()) {
+		return mismatches + 1;
+	}
+	for (x = 0; x < board.column.size(); x++) {
+		if (resp.return_->states[x]->item.size() != (size_t)board.column[x]) {
+			return mismatches + 1;
+		}
+		for (y = 0; y < resp.return_->states[x]->item.size(); y++) {
+			mismatches += (resp.return_->states[x]->item[y] != board.square[next++]);
+		}
+	}
+	return mismatches;
+}
+
+//Times decoding a getStatus and a login response with the generated DOM
+//against recvStatus/recvBoard. Both read the same bytes through s.soap->is,
+//so only the decode differs. Without files the responses are made up from
+//board1.map.
+void NetworkCore::benchDecode(const char* status_file, const char* board_file, int rounds)
+{
+	StatCounter stat_dom[2];
+	StatCounter stat_stream[2];
+	platformstl::performance_counter decode_timer;
+	ns1__getStatusResponse status_resp;
+	ns1__loginResponse login_resp;
+	StatusFrame frame;
+	BoardFrame board;
+	istringstream in;
+	string xml[2];
+	const char* what[2] = {"getStatus", "login"};
+	int i,k,failed = 0,mismatches = 0;
+	if (!status_file || !board_file) {
+		ifstream fin("board1.map");
+		fin >> *state;
+		state->endgame_tick = 200;
+		fin.close();
+	}
+	if (status_file) {
+		if (!decodeFile(status_file, xml[0])) {
+			cerr << "Can't read " << status_file << endl;
+			return;
+		}
+	} else {
+		xml[0] = decodeStatusXML(*state);
+	}
+	if (board_file) {
+		if (!decodeFile(board_file, xml[1])) {
+			cerr << "Can't read " << board_file << endl;
+			return;
+		}
+	} else {
+		xml[1] = decodeBoardXML(*state);
+	}
+	for (k = 0; k < 2; k++) {
+		stat_dom[k].init();
+		stat_stream[k].init();
+	}
+	s.soap->is = &in;
+	for (i = 0; i < rounds; i++) {
+		for (k = 0; k < 2; k++) {
+			in.clear();
+			in.str(xml[k]);
+			decode_timer.restart();
+			soaperr = k ? decodeDOM(s.soap, login_resp) : decodeDOM(s.soap, status_resp);
+			decode_timer.stop();
+			stat_dom[k].push((double)decode_timer.get_microseconds());
+			if (soaperr != SOAP_OK) {
+				failed++;
+			}
+
+			in.clear();
+			in.str(xml[k]);
+			decode_timer.restart();
+			soaperr = k ? recvBoard(board) : recvStatus(frame);
+			decode_timer.stop();
+			stat_stream[k].push((double)decode_timer.get_microseconds());
+			if (soaperr != SOAP_OK) {
+				failed++;
+			}
+			if (i == 0) {
+				mismatches += k ? decodeMismatches(login_resp, board) : decodeMismatches(status_resp, frame);
+			}
+			recycle();
+		}
+	}
+	s.soap->is = NULL;
+	for (k = 0; k < 2; k++) {
+		cout << what[k] << " (" << xml[k].size() << " bytes): DOM " << stat_dom[k].mean() << " us (sd "
+				<< sqrt(stat_dom[k].variance()) << "), streamed " << stat_stream[k].mean() << " us (sd "
+				<< sqrt(stat_stream[k].variance()) << ") over " << stat_dom[k].count() << " rounds" << endl;
+	}
+	cout << "Streamed decode disagrees with the DOM on " << mismatches << " fields" << endl;
+	if (failed) {
+		cout << failed << " decodes failed" << endl;
+		s.soap_stream_fault(std::cerr);
+	}
+	soaperr = SOAP_OK;
+}
+
+bool NetworkCore::record(const char* filename)
+{
+	capture = new SoapCapture;
+	if (!capture->open(s.soap, filename)) {
+		cerr << "Can't record to " << filename << endl;
+		delete capture;
+		capture = NULL;
+		return false;
+	}
+	return true;
+}
+
+//Reads back what SoapCapture wrote
+static bool readCapture(const char* filename, vector<CapturedCall>& calls)
+{
+	ifstream fin(filename, ios::in | ios::binary);
+	CapturedCall call;
+	string* bytes;
+	char direction;
+	double at;
+	size_t length;
+	if (!fin) {
+		return false;
+	}
+	while (fin >> direction >> at >> length) {
+		fin.get(); //'\n'
+		if (direction == '>') {
+			call.sent_at = at;
+			call.received_at = at;
+			call.response.clear();
+			calls.push_back(call);
+			bytes = &calls.back().request;
+		} else if (direction == '<' && !calls.empty()) {
+			calls.back().received_at = at;
+			bytes = &calls.back().response;
+		} else {
+			return false;
+		}
+		bytes->resize(length);
+		if (length > 0 && !fin.read(&(*bytes)[0], length)) {
+			return false;
+		}
+	}
+	return !calls.empty();
+}
+
+void NetworkCore::replay(const char* filename, double speed)
+{
+	vector<CapturedCall> calls;
+	BoardFrame board;
+	istringstream in;
+	size_t k;
+	if (!readCapture(filename, calls)) {
+		cerr << "Can't read a recording from " << filename << endl;
+		return;
+	}
+	for (k = 0; k < calls.size(); k++) {
+		if (calls[k].request.find("ns1:login") != string::npos) {
+			break;
+		}
+	}
+	if (k == calls.size()) {
+		cerr << "No login in " << filename << endl;
+		return;
+	}
+	s.soap->is = &in;
+	in.str(calls[k].response);
+	soaperr = recvBoard(board);
+	if (soaperr == SOAP_OK) {
+		applyBoard(board);
+	} else {
+		s.soap_stream_fault(std::cerr);
+	}
+	recycle();
+	s.soap->is = NULL;
+	if (soaperr != SOAP_OK) {
+		return;
+	}
+	state_synced = false;
+	state->gameover = false;
+	state->stop_playout = false;
+	cout << "Replaying " << calls.size() << " calls from " << filename << " at " << speed << "x" << endl;
+	replay_calls = &calls;
+	replay_speed = speed;
+	play();
+	replay_calls = NULL;
+}
+
+//Stands in for ioLoop: hands the search each recorded getStatus response
+//when it came in, scaled by replay_speed, and times how long the decode
+//takes and how long the search takes to first publish actions for the tick.
+//Nothing is sent.
+void NetworkCore::replayLoop()
+{
+	vector<CapturedCall>& calls = *replay_calls;
+	StatCounter stat_decode;
+	StatCounter stat_decision;
+	platformstl::performance_counter clock;
+	platformstl::performance_counter decode_timer;
+	StatusFrame frame;
+	istringstream in;
+	ns1__action action[2];
+	double first_at = -1.0;
+	double due,published_at,waited;
+	bool decided;
+	int num_undecided = 0;
+	size_t k;
+	stat_decode.init();
+	stat_decision.init();
+	clock.restart();
+	s.soap->is = &in;
+	for (k = 0; k < calls.size(); k++) {
+		if (calls[k].request.find("ns1:getStatus") == string::npos || calls[k].response.empty()) {
+			continue;
+		}
+		if (first_at < 0.0) {
+			first_at = calls[k].received_at;
+		}
+		if (replay_speed > 0.0) {
+			due = (calls[k].received_at-first_at)/replay_speed;
+			if (due > elapsedMs(clock)) {
+				Sleep((uint32_t)(due-elapsedMs(clock)));
+			}
+		}
+		in.clear();
+		in.str(calls[k].response);
+		decode_timer.restart();
+		soaperr = recvStatus(frame);
+		if (soaperr != SOAP_OK) {
+			//The game ended, or the connection had trouble at the time
+			s.soap_stream_fault(std::cerr);
+			recycle();
+			continue;
+		}
+		if (state_synced && state->tickno == frame.tick) {
+			decode_timer.stop();
+			stat_decode.push((double)decode_timer.get_microseconds()/1000.0);
+			recycle();
+			continue;
+		}
+		state->tickno = frame.tick;
+		syncStatus(frame);
+		decode_timer.stop();
+		stat_decode.push((double)decode_timer.get_microseconds()/1000.0);
+		recycle();
+		publishState();
+		published_at = elapsedMs(clock);
+		//To the nearest ms
+		decided = false;
+		waited = 0.0;
+		while (!decided && waited < REPLAY_DECISION_MS) {
+			decided = takeAction(state->tickno,action);
+			if (!decided) {
+				Sleep(1);
+				waited = elapsedMs(clock)-published_at;
+			}
+		}
+		if (decided) {
+			stat_decision.push(elapsedMs(clock)-published_at);
+		} else {
+			num_undecided++;
+		}
+	}
+	s.soap->is = NULL;
+	soaperr = SOAP_OK;
+	cout << "Decode: " << stat_decode.mean() << " ms avg (sd " << sqrt(stat_decode.variance()) << ") over "
+			<< stat_decode.count() << " getStatus responses" << endl;
+	cout << "Tick to decision: " << stat_decision.mean() << " ms avg (sd " << sqrt(stat_decision.variance()) << ") over "
+			<< stat_decision.count() << " ticks" << endl;
+	if (num_undecided) {
+		cout << num_undecided << " ticks got no decision within " << REPLAY_DECISION_MS << " ms" << endl;
+	}
+	handoff_mutex.lock();
+	playing = false;
+	handoff_mutex.unlock();
 }
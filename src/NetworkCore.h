@@ -16,7 +16,12 @@
 #include "soap/nsmap.h"
 #include "consts.h"
 #include "PlayoutState.h"
+#include <tinythread.h>
+#include <fast_mutex.h>
+#include <platformstl/performance/performance_counter.hpp>
+#include <fstream>
 #include <string>
+#include <vector>
 #include <utility>
 #include <algorithm>
 #include <functional>
@@ -28,18 +33,185 @@ using namespace std;
 #define POLICY_FIXED 2
 #define POLICY_MCTS 3
 
+#define STATUS_PLAYERS 2
+#define STATUS_UNITS 2 //Units or bullets kept per player
+
+//One player out of a getStatus response, see readStatus
+struct StatusPlayer {
+	bool named;
+	string name;
+	bool based;
+	int base_x;
+	int base_y;
+	int num_units; //Counts any past STATUS_UNITS, which are dropped
+	TankState unit[STATUS_UNITS];
+	int num_bullets; //Likewise
+	BulletState bullet[STATUS_UNITS];
+};
+
+struct BlockDelta {
+	int x;
+	int y;
+	int newstate; //ns1__state, -1 if the event didn't say
+};
+
+//A getStatus response decoded straight off the wire, without gSOAP's
+//ns1__ objects. Reused from call to call, so the strings and blocks keep
+//their capacity.
+struct StatusFrame {
+	int tick;
+	LONG64 ms_to_next;
+	bool named;
+	string player_name;
+	int num_players; //Counts any past STATUS_PLAYERS, which are dropped
+	StatusPlayer player[STATUS_PLAYERS];
+	bool has_events;
+	vector<BlockDelta> blocks;
+};
+
+//A login response: the board's columns back to back
+struct BoardFrame {
+	int endgame_tick;
+	vector<int> column; //Squares in each column
+	vector<unsigned char> square; //ns1__state of each square
+};
+
+//Bump allocator behind soap_malloc: what gSOAP deserializes into comes off
+//a few big blocks that rewind() hands back in one go. Blocks only grow, so
+//after the first few calls a whole response fits in one block.
+class SoapArena {
+private:
+	vector< pair<char*,size_t> > block;
+	size_t used;
+public:
+	SoapArena();
+	~SoapArena();
+	void* alloc(size_t n);
+	void rewind();
+	//soap->fmalloc hook, soap->user points at the arena
+	static void* soapMalloc(struct soap* soap, size_t n);
+};
+
+//Records the bytes of every call as they go over the wire, through gSOAP's
+//fsend/frecv hooks. A call is written as two records, the request and the
+//response: "> ms length\n" or "< ms length\n", then the bytes. ms runs from
+//when the recording started to the first byte each way.
+class SoapCapture {
+private:
+	ofstream out;
+	platformstl::performance_counter clock;
+	string sent;
+	string received;
+	double sent_at;
+	double received_at;
+	int (*fsend)(struct soap*, const char*, size_t);
+	size_t (*frecv)(struct soap*, char*, size_t);
+	double elapsedMs();
+	void write(const char direction, const double at, const string& bytes);
+	static int captureSend(struct soap* soap, const char* buf, size_t len);
+	static size_t captureRecv(struct soap* soap, char* buf, size_t len);
+	static int plugin(struct soap* soap, struct soap_plugin* p, void* arg);
+	static void pluginDelete(struct soap* soap, struct soap_plugin* p);
+public:
+	bool open(struct soap* soap, const char* filename);
+	//Writes out the call that's just finished
+	void flush();
+};
+
+//One call out of a SoapCapture recording
+struct CapturedCall {
+	double sent_at;
+	string request;
+	double received_at;
+	string response;
+};
+
+#define LATENCY_SAMPLES 200 //Per kind, the most recent are kept
+#define LATENCY_UNKNOWN_MS 500.0 //Assumed until there is a sample
+
+//The last LATENCY_SAMPLES latencies of one kind of call, in ms
+class LatencyWindow {
+private:
+	vector<double> sample;
+	size_t next;
+	mutable vector<double> scratch;
+public:
+	LatencyWindow();
+	void push(double ms);
+	//The q-th quantile, or the worst sample while there are too few to tell
+	double quantile(double q) const;
+	size_t count() const;
+};
+
+//Schedules ioLoop's tick: how late actions can be sent so that at most
+//TIMING_MISS_TARGET of them miss the tick, and when to poll for the next.
+class TickTimer {
+private:
+	double extra; //Added to the send budget after misses, halved on hits
+	int num_sent;
+	int num_missed;
+public:
+	LatencyWindow getstatus; //Round trip, decode included
+	LatencyWindow decode; //Frame into PlayoutState and handed to the search
+	LatencyWindow submit; //setActions, or all the setAction calls
+	double tick_length; //Longest millisecondsToNextTick seen
+	TickTimer();
+	//How long before the tick ends actions have to go out
+	double sendBudget() const;
+	//How long to wait before polling again for a tick that hasn't started
+	double retryDelay() const;
+	//The submission's millisecondsToNextTick against what was left of the
+	//tick when it went out, tells whether it landed in the next tick
+	bool sent(double ms_left, double ms_to_next);
+	void report() const;
+};
+
 class NetworkCore {
 private:
-	PlayoutState* state;
+	PlayoutState* state; //ioLoop decodes into this
+	SoapArena arena; //Must outlive s
+	SoapCapture* capture; //Set by record()
+	vector<CapturedCall>* replay_calls; //Set by replay(), ioThread runs replayLoop instead
+	double replay_speed;
 	ChallengeServiceSoapBindingProxy s;
 	string myname;
 	bool state_synced;
 	int soaperr;
+	//Handoff between ioLoop and the search in play(), under handoff_mutex
+	tthread::fast_mutex handoff_mutex;
+	PlayoutState* spare; //ioLoop's side of the triple buffer
+	PlayoutState* handoff;
+	bool handoff_fresh;
+	int best_tick; //The tick best_action is meant for
+	ns1__action best_action[2];
+	bool playing;
+	void recycle();
+	void ioLoop();
+	void replayLoop();
+	static void ioThread(void* param);
+	void publishState();
+	bool takeState(PlayoutState*& mine);
+	void publishAction(int tickno, const ns1__action action[2]);
+	bool takeAction(int tickno, ns1__action action[2]);
+	bool isPlaying();
+	int fetchBoard(BoardFrame& board);
+	int fetchStatus(StatusFrame& frame);
+	int recvStatus(StatusFrame& frame);
+	int recvBoard(BoardFrame& board);
+	void applyBoard(BoardFrame& board);
+	void syncStatus(StatusFrame& frame);
 public:
 	int policy;
 	NetworkCore(const char* soap_endpoint);
 	void login();
 	void play();
+	void benchStatus(int calls);
+	void benchDecode(const char* status_file, const char* board_file, int rounds);
+	//Records every call from here on to filename
+	bool record(const char* filename);
+	//Plays a recording's getStatus responses back into the search, speed
+	//times as fast as they were recorded, or as fast as it decides at 0
+	void replay(const char* filename, double speed);
 	~NetworkCore();
 };
 
@@ -15,7 +15,6 @@
 #include <functional>
 #include <iomanip>
 #include <iostream>
-#include <queue>
 #include "PlayoutState.h"
 #include "SFMT.h"
 #include "MCTree.h"
@@ -67,14 +66,112 @@ void PlayoutState::drawBullets()
 	}
 }
 
+void PlayoutState::resize(const int width, const int height)
+//Make room for a width by height map, all empty
+{
+	board.resize(width,height);
+	occupant.resize(width,height);
+	wallbits[O_X].resize(height,WALL_WORDS(width));
+	wallbits[O_Y].resize(width,WALL_WORDS(height));
+	min_x = 0;
+	min_y = 0;
+	max_x = width;
+	max_y = height;
+	path_shift = pathShift(height);
+}
+
+void PlayoutState::drawWalls()
+{
+	int x,y;
+	wallbits[O_X].fill(0);
+	wallbits[O_Y].fill(0);
+	for (x = 0; x < board.width; x++) {
+		for (y = 0; y < board.height; y++) {
+			if (board[x][y] & B_WALL) {
+				wallbits[O_X][y][x >> 5] |= 1u << (x & 31);
+				wallbits[O_Y][x][y >> 5] |= 1u << (y & 31);
+			}
+		}
+	}
+}
+
+void PlayoutState::markWall(const int x, const int y)
+//Bring wallbits in line with board[x][y]
+{
+	if (board[x][y] & B_WALL) {
+		wallbits[O_X][y][x >> 5] |= 1u << (x & 31);
+		wallbits[O_Y][x][y >> 5] |= 1u << (y & 31);
+	} else {
+		wallbits[O_X][y][x >> 5] &= ~(1u << (x & 31));
+		wallbits[O_Y][x][y >> 5] &= ~(1u << (y & 31));
+	}
+}
+
+//Map geometry for the simulator and pathfinder. AnyDim reads the size off the
+//state, FixedDim<W,H> has it compiled in: min_y is always 0, and the endgame
+//closes in on x from both sides, so max_x is W-min_x.
+struct AnyDim {
+	static int maxX(const PlayoutState& p) { return p.max_x; }
+	static int minY(const PlayoutState& p) { return p.min_y; }
+	static int maxY(const PlayoutState& p) { return p.max_y; }
+	static bool insideBounds(const PlayoutState& p, const int x, const int y) {
+		return (x >= p.min_x && y >= p.min_y && x < p.max_x && y < p.max_y);
+	}
+	static bool isTankInsideBounds(const PlayoutState& p, const int x, const int y) {
+		return (x > (p.min_x+1) && y > (p.min_y+1) && x < (p.max_x-2) && y < (p.max_y-2));
+	}
+};
+
+template <int W, int H> struct FixedDim {
+	static int maxX(const PlayoutState& p) { return W-p.min_x; }
+	static int minY(const PlayoutState&) { return 0; }
+	static int maxY(const PlayoutState&) { return H; }
+	static bool insideBounds(const PlayoutState& p, const int x, const int y) {
+		return (x >= p.min_x && x < W-p.min_x && (unsigned int)y < (unsigned int)H);
+	}
+	static bool isTankInsideBounds(const PlayoutState& p, const int x, const int y) {
+		return (x > (p.min_x+1) && x < (W-2-p.min_x) && (unsigned int)(y-2) < (unsigned int)(H-4));
+	}
+};
+
+//Only the sizes we have maps for: each one is another copy of simulateTick,
+//playout, drawFootprint and findPath, and any other size still plays on AnyDim
+typedef FixedDim<81,81> Map81x81;
+
+int PlayoutState::mapSize()
+//Which instantiation fits this map
+{
+	if (min_y == 0 && min_x+max_x == 81 && max_y == 81) {
+		return MAP_81X81;
+	}
+	return MAP_ANY;
+}
+
+int PlayoutState::tankAt(const int x, const int y)
+{
+	return tankAt<AnyDim>(x,y);
+}
+
+template <class Dim>
+int PlayoutState::tankAt(const int x, const int y)
+//The active tank covering (x,y), -1 if there isn't one
+{
+	int t;
+	if (!Dim::insideBounds(*this,x,y) || !(board[x][y] & B_TANK)) {
+		return -1;
+	}
+	t = occupant[x][y];
+	return tank[t].active ? t : -1;
+}
+
 bool PlayoutState::insideBounds(const int x, const int y)
 {
-	return (x >= min_x && y >= min_y && x < max_x && y < max_y);
+	return AnyDim::insideBounds(*this,x,y);
 }
 
 bool PlayoutState::isTankInsideBounds(const int x, const int y)
 {
-	return (x > (min_x+1) && y > (min_y+1) && x < (max_x-2) && y < (max_y-2));
+	return AnyDim::isTankInsideBounds(*this,x,y);
 }
 
 bool PlayoutState::canRotate(const int x, const int y, const int o, board_t& obstacles)
@@ -99,12 +196,7 @@ bool PlayoutState::insideTank(const unsigned int t, const int x, const int y)
 
 bool PlayoutState::insideAnyTank(const int x, const int y)
 {
-	int i;
-	bool inside = false;
-	for (i = 0; i < 4 && inside; i++) {
-		inside = insideTank(i,x,y);
-	}
-	return inside;
+	return tankAt(x,y) >= 0;
 }
 
 bool PlayoutState::insideTinyTank(const int t, const int x, const int y)
@@ -124,6 +216,7 @@ void PlayoutState::drawTank(const int t, const int block)
 	for (i = tank[t].x-2; i < tank[t].x+3; i++) {
 		for (j = tank[t].y-2; j < tank[t].y+3; j++) {
 			board[i][j] = block;
+			occupant[i][j] = t;
 		}
 	}
 }
@@ -154,10 +247,17 @@ void PlayoutState::drawTinyTank(const int t, const int block)
 	for (i = tank[t].x-1; i < tank[t].x+2; i++) {
 		for (j = tank[t].y-1; j < tank[t].y+2; j++) {
 			board[i][j] = block;
+			occupant[i][j] = t;
 		}
 	}
 }
 
+void PlayoutState::moveBullets()
+{
+	moveBullets<AnyDim>();
+}
+
+template <class Dim>
 void PlayoutState::moveBullets()
 {
 	int i;
@@ -166,7 +266,7 @@ void PlayoutState::moveBullets()
 			board[bullet[i].x][bullet[i].y] ^= B_LOOKUP(bullet[i].o);
 			bullet[i].x += O_LOOKUP(bullet[i].o,O_X);
 			bullet[i].y += O_LOOKUP(bullet[i].o,O_Y);
-			if (insideBounds(bullet[i].x,bullet[i].y)) {
+			if (Dim::insideBounds(*this,bullet[i].x,bullet[i].y)) {
 				board[bullet[i].x][bullet[i].y] |= B_LOOKUP(bullet[i].o);
 			} else {
 				bullet[i].active = 0;
@@ -176,6 +276,7 @@ void PlayoutState::moveBullets()
 	//NOTE: MUST RESOLVE COLLISIONS AFTER THIS!
 }
 
+template <class Dim>
 void PlayoutState::moveTanks()
 {
 	int i,j,t,c,x,y,square;
@@ -215,7 +316,7 @@ void PlayoutState::moveTanks()
 			y = tank[t].y;
 			newx = x + O_LOOKUP(tank[t].o,O_X);
 			newy = y + O_LOOKUP(tank[t].o,O_Y);
-			if (isTankInsideBounds(newx,newy)) {
+			if (Dim::isTankInsideBounds(*this,newx,newy)) {
 				clear = true;
 				for (j = 0; j < 5; j++) {
 					square = board[x+BUMP_LOOKUP(tank[t].o,j,O_X)][y+BUMP_LOOKUP(tank[t].o,j,O_Y)];
@@ -229,6 +330,7 @@ void PlayoutState::moveTanks()
 					//Set new points and unset old ones
 					for (j = 0; j < 5; j++) {
 						board[x+BUMP_LOOKUP(tank[t].o,j,O_X)][y+BUMP_LOOKUP(tank[t].o,j,O_Y)] |= B_TANK;
+						occupant[x+BUMP_LOOKUP(tank[t].o,j,O_X)][y+BUMP_LOOKUP(tank[t].o,j,O_Y)] = t;
 						board[newx-BUMP_LOOKUP(tank[t].o,j,O_X)][newy-BUMP_LOOKUP(tank[t].o,j,O_Y)] ^= B_TANK;
 					}
 				}
@@ -240,6 +342,7 @@ void PlayoutState::moveTanks()
 	//NOTE: MUST RESOLVE COLLISIONS AFTER THIS!
 }
 
+template <class Dim>
 void PlayoutState::fireTanks()
 {
 	int i;
@@ -247,7 +350,7 @@ void PlayoutState::fireTanks()
 		if ((command[i] == C_FIRE) && (tank[i].active) && (!bullet[i].active)) {
 			bullet[i].x = tank[i].x + FIRE_LOOKUP(tank[i].o,O_X);
 			bullet[i].y = tank[i].y + FIRE_LOOKUP(tank[i].o,O_Y);
-			if (insideBounds(bullet[i].x,bullet[i].y)) {
+			if (Dim::insideBounds(*this,bullet[i].x,bullet[i].y)) {
 				bullet[i].active = 1;
 				bullet[i].o = tank[i].o;
 				board[bullet[i].x][bullet[i].y] |= B_LOOKUP(tank[i].o);
@@ -257,10 +360,11 @@ void PlayoutState::fireTanks()
 	//NOTE: MUST RESOLVE COLLISIONS AFTER THIS!
 }
 
+template <class Dim>
 void PlayoutState::checkCollisions()
 {
 	unsigned int j,square,other_bullet,x,y,prevsquare;
-	int i;
+	int i,hit;
 	bool baseok[2];
 	baseok[0] = true;
 	baseok[1] = true;
@@ -270,7 +374,7 @@ void PlayoutState::checkCollisions()
 		bullet[i].tag = 0;
 	}
 	for (i = 0; i < 4; i++) {
-		if (isTankInsideBounds(tank[i].x,tank[i].y)) {
+		if (Dim::isTankInsideBounds(*this,tank[i].x,tank[i].y)) {
 			tank[i].tag = 0;
 		} else {
 			tank[i].tag = 1;
@@ -278,12 +382,7 @@ void PlayoutState::checkCollisions()
 	}
 
 	for (j = 0; j < 2; j++) {
-		baseok[j] = true;
-		for (i = 0; i < 4; i++) {
-			if (insideTank(i,base[j].x,base[j].y)) {
-				baseok[j] = false;
-			}
-		}
+		baseok[j] = tankAt<Dim>(base[j].x,base[j].y) < 0;
 	}
 
 	if (!baseok[PLAYER0] && !baseok[PLAYER1]) {
@@ -320,15 +419,17 @@ void PlayoutState::checkCollisions()
 				for (j = 0; j < 4;j++) {
 					x = bullet[i].x + B_SPLASH(bullet[i].o,j,B_X);
 					y = bullet[i].y + B_SPLASH(bullet[i].o,j,B_Y);
-					if (insideBounds(x,y)) {
+					if (Dim::insideBounds(*this,x,y)) {
 						if (board[x][y] == B_WALL) {
 							board[x][y] = B_EMPTY;
+							markWall(x,y);
 						}
 					}
 				}
 				if (!other_bullet) {
 					//Remove wall under bullet
 					board[bullet[i].x][bullet[i].y] = B_EMPTY;
+					markWall(bullet[i].x,bullet[i].y);
 					bullet[i].active = 0;
 				} else {
 					//Remove the bullet from the board
@@ -337,11 +438,9 @@ void PlayoutState::checkCollisions()
 				}
 				break;
 			case B_TANK:
-				for (j = 0; j < 4; j++) {
-					if (insideTank(j,bullet[i].x,bullet[i].y)) {
-						tank[j].tag = 1;
-						break;
-					}
+				hit = tankAt<Dim>(bullet[i].x,bullet[i].y);
+				if (hit >= 0) {
+					tank[hit].tag = 1;
 				}
 				bullet[i].active = 0;
 				break;
@@ -398,7 +497,9 @@ void PlayoutState::checkCollisions()
 	//Erase tagged bullets
 	for (i = 0; i < 4; i++) {
 		if (bullet[i].active && bullet[i].tag) {
+			//Might take a wall with it
 			board[bullet[i].x][bullet[i].y] = B_EMPTY;
+			markWall(bullet[i].x,bullet[i].y);
 			bullet[i].active = 0;
 		}
 	}
@@ -456,11 +557,10 @@ void PlayoutState::checkDestroyedBullets()
 			other_bullet = ((board[bullet[i].x][bullet[i].y] & (B_BULLET)) != B_LOOKUP(bullet[i].o));
 			square = board[bullet[i].x][bullet[i].y] & (B_DESTRUCTABLES);
 			if (square == B_TANK) {
-				j = 0;
-				while ((j < 3) && !insideTinyTank(j,bullet[i].x,bullet[i].y)) {
-					j++;
+				j = tankAt(bullet[i].x,bullet[i].y);
+				if (j >= 0) {
+					tank[j].tag = 1;
 				}
-				tank[j].tag = 1;
 				bullet[i].active = 0;
 			}
 			if (other_bullet) {
@@ -472,7 +572,9 @@ void PlayoutState::checkDestroyedBullets()
 	//Erase tagged bullets
 	for (i = 0; i < 4; i++) {
 		if (bullet[i].active && bullet[i].tag) {
+			//Might take a wall with it
 			board[bullet[i].x][bullet[i].y] = B_EMPTY;
+			markWall(bullet[i].x,bullet[i].y);
 			bullet[i].active = 0;
 		}
 	}
@@ -485,6 +587,19 @@ void PlayoutState::checkDestroyedBullets()
 	}
 }
 
+void PlayoutState::simulateTick()
+{
+	switch (mapSize()) {
+	case MAP_81X81:
+		simulateTick<Map81x81>();
+		break;
+	default:
+	case MAP_ANY:
+		simulateTick<AnyDim>();
+	}
+}
+
+template <class Dim>
 void PlayoutState::simulateTick()
 {
 	tickno++;
@@ -494,21 +609,21 @@ void PlayoutState::simulateTick()
 		max_x--;
 	}
 	gameover = false;
-	moveBullets();
-	checkCollisions();
+	moveBullets<Dim>();
+	checkCollisions<Dim>();
 	if (gameover) {
 		return;
 	}
 
-	moveBullets();
-	moveTanks();
-	checkCollisions();
+	moveBullets<Dim>();
+	moveTanks<Dim>();
+	checkCollisions<Dim>();
 	if (gameover) {
 		return;
 	}
 
-	fireTanks();
-	checkCollisions();
+	fireTanks<Dim>();
+	checkCollisions<Dim>();
 }
 
 void PlayoutState::updateCanFire()
@@ -541,69 +656,148 @@ void PlayoutState::move(Move& m)
 	simulateTick();
 }
 
-double PlayoutState::playout(sfmt_t* sfmt, UtilityScores& utility)
+//Playout policies: each fills in command[] for the coming tick. playout is
+//instantiated once per policy (and map size), so the choice is compiled into its loop.
+struct RandomPolicy {
+	static void choose(PlayoutState& state, sfmt_t* sfmt, UtilityScores& utility);
+};
+
+struct GreedyTablePolicy {
+	static void choose(PlayoutState& state, sfmt_t* sfmt, UtilityScores& utility);
+};
+
+struct GreedyPolicy {
+	static void choose(PlayoutState& state, sfmt_t* sfmt, UtilityScores& utility);
+};
+
+void RandomPolicy::choose(PlayoutState& state, sfmt_t* sfmt, UtilityScores&)
 {
+	int tankid;
+	for (tankid = 0; tankid < 4; tankid++) {
+		state.command[tankid] = state.randomC(tankid,sfmt);
+	}
+}
+
+void GreedyTablePolicy::choose(PlayoutState& state, sfmt_t* sfmt, UtilityScores& utility)
+{
+	int tankid,t;
+	for (tankid = 0; tankid < 4; tankid++) {
+		if (randomChance(sfmt,RANDOM_CHANCE(EPSILON_GREEDY-1,100))) {
+			//EPSILON_GREEDY% of the moves are "greedy" moves, for every tank at once
+			for (t = 0; t < 4; t++) {
+				if (state.tank[t].active) {
+					state.tank[t].canfire = !state.bullet[t].active;
+					state.command[t] = state.greedyC(t,utility);
+				}
+			}
+			return;
+		}
+		state.command[tankid] = state.randomC(tankid,sfmt);
+	}
+}
+
+void GreedyPolicy::choose(PlayoutState& state, sfmt_t* sfmt, UtilityScores& utility)
+//GreedyTablePolicy without the table
+{
+	int tankid,t;
+	scored_cmds_t cmds;
+	for (tankid = 0; tankid < 4; tankid++) {
+		if (randomChance(sfmt,RANDOM_CHANCE(EPSILON_GREEDY-1,100))) {
+			for (t = 0; t < 4; t++) {
+				if (state.tank[t].active) {
+					state.tank[t].canfire = !state.bullet[t].active;
+					cmds.clear();
+					state.command[t] = state.bestC(t,utility.simplecost[t/2],cmds);
+				}
+			}
+			return;
+		}
+		state.command[tankid] = state.randomC(tankid,sfmt);
+	}
+}
+
+template <class Policy, class Dim>
+double PlayoutState::playout(sfmt_t* sfmt, UtilityScores& utility, const int depth)
+//Play on to the end of the game, or for depth ticks and guess the rest
+{
+	int move;
 #if DEBUG
-	bool pickedgreedy[4];
+	int tankid;
 #endif
-	int move,tankid;
 	int maxmove = endgame_tick+(max_x/2)-tickno;
+	bool truncated = (depth > 0 && depth < maxmove);
+	if (truncated) {
+		maxmove = depth;
+	}
 	winner = W_DRAW;
-	scored_cmds_t cmds;
 	for (move = 0; move < maxmove; move++) {
-		//Expensive version
-		/*
-		updateCanFire();
-		updateSimpleUtilityScores();
-		updateExpensiveUtilityScores();*/
-		for (tankid = 0; tankid < 4; tankid++) {
-			if (sfmt_genrand_uint32(sfmt) % 100 < (EPSILON_GREEDY-1)) {
-				//EPSILON_GREEDY% of the moves are "greedy" moves.
-#if DEBUG
-				pickedgreedy[tankid] = true;
-#endif
-				for (tankid = 0; tankid < 4; tankid++) {
-					if (tank[tankid].active) {
-						//Cheap version
-						tank[tankid].canfire = !bullet[tankid].active;
-						cmds.clear();
-						command[tankid] = bestC(tankid,utility.simplecost[tankid/2],cmds);
-					}
-				}
-			} else {
-#if DEBUG
-				pickedgreedy[tankid] = false;
-#endif
-				//Random playout
-				command[tankid] = sfmt_genrand_uint32(sfmt) % 6;
-				//command[tankid] = tank[tankid].active * ((tank[tankid].canfire)*(sfmt_genrand_uint32(&sfmt) % 6)
-				//		+ (1-tank[tankid].canfire)*(sfmt_genrand_uint32(&sfmt) % 4));
-			}
-		}
+		Policy::choose(*this,sfmt,utility);
 #if DEBUG
 		paintUtilityScores();
 		cout << "commands:";
 		for (tankid = 0; tankid < 4; tankid++) {
 			if (tank[tankid].active) {
-				cout << " [" << tankid << ": " << cmd2str(command[tankid]);
-				if (pickedgreedy[tankid]) {
-					cout << "*";
-				}
-				cout << "]";
+				cout << " [" << tankid << ": " << cmd2str(command[tankid]) << "]";
 			}
 		}
 		cout << endl;
 #endif
-		simulateTick();
+		simulateTick<Dim>();
 		//paint();
 		if (gameover) {
 			return winner;
 		}
-		if (stop_playout && (sfmt_genrand_uint32(sfmt) % 10 == 0)) {
+		if (stop_playout && randomChance(sfmt,RANDOM_CHANCE(1,10))) {
 			return state_score;
 		}
 	}
-	return state_score;
+	return truncated ? evaluate(utility) : state_score;
+}
+
+double PlayoutState::playout(sfmt_t* sfmt, UtilityScores& utility, const int depth, const int policy)
+{
+	switch (mapSize()) {
+	case MAP_81X81:
+		return playout<Map81x81>(sfmt,utility,depth,policy);
+	default:
+	case MAP_ANY:
+		return playout<AnyDim>(sfmt,utility,depth,policy);
+	}
+}
+
+template <class Dim>
+double PlayoutState::playout(sfmt_t* sfmt, UtilityScores& utility, const int depth, const int policy)
+{
+	switch (policy) {
+	case PLAYOUT_RANDOM:
+		return playout<RandomPolicy,Dim>(sfmt,utility,depth);
+	case PLAYOUT_GREEDY:
+		return playout<GreedyPolicy,Dim>(sfmt,utility,depth);
+	default:
+	case PLAYOUT_GREEDYTABLE:
+		return playout<GreedyTablePolicy,Dim>(sfmt,utility,depth);
+	}
+}
+
+double PlayoutState::evaluate(UtilityScores& utility)
+//Static guess at the result of a game that's still going: state_score's tank
+//count, nudged towards whichever player's closest tank is nearer the enemy base
+{
+	int p,t,cost,best[2];
+	double score = state_score;
+	for (p = 0; p < 2; p++) {
+		best[p] = INT_MAX;
+		for (t = p*2; t < p*2+2; t++) {
+			if (tank[t].active) {
+				cost = utility.simplecost[p](tank[t].x,tank[t].y,tank[t].o);
+				best[p] = min(best[p],cost);
+			}
+		}
+	}
+	if (best[PLAYER0] < INT_MAX && best[PLAYER1] < INT_MAX && best[PLAYER0]+best[PLAYER1] > 0) {
+		score += EVAL_DISTANCE_WEIGHT*(best[PLAYER1]-best[PLAYER0])/(double)(best[PLAYER0]+best[PLAYER1]);
+	}
+	return min(W_PLAYER0,max(W_PLAYER1,score));
 }
 
 bool PlayoutState::clearFireTrajectory(int x, int y, int o, int t_x, int t_y, board_t& obstacles)
@@ -698,7 +892,89 @@ bool PlayoutState::clearablePath(int x, int y, int o)
 	return (board[x+FIRE_LOOKUP(o,O_X)][y+FIRE_LOOKUP(o,O_Y)] & B_WALL) == B_WALL;
 }
 
-void PlayoutState::seedBase(const int player, priority_queue<Tank>& frontier, board_t& obstacles)
+int PlayoutState::footprintAt(const int x, const int y, board_t& obstacles)
+{
+	int o,i,j,f = 0;
+	if (!isTankInsideBounds(x,y)) {
+		return 0;
+	}
+	for (o = 0; o < 4; o++) {
+		//A move off the tank's bounds never gets asked about
+		if (isTankInsideBounds(x+O_LOOKUP(o,O_X),y+O_LOOKUP(o,O_Y))) {
+			f |= canMove(x,y,o,obstacles) ? F_MOVE(o) : 0;
+			f |= clearablePath(x,y,o,obstacles) ? F_CLEARABLE(o) : 0;
+		}
+		f |= canRotate(x,y,o,obstacles) ? F_ROTATE(o) : 0;
+	}
+	for (i = x-2; i < x+3; i++) {
+		for (j = y-2; j < y+3; j++) {
+			f |= (obstacles[i][j] & B_OOB) ? F_EXPOSED : 0;
+		}
+	}
+	return f;
+}
+
+void PlayoutState::drawFootprint(footprint_t& footprint, board_t& obstacles, footprint_t& runs)
+{
+	switch (mapSize()) {
+	case MAP_81X81:
+		drawFootprint<Map81x81>(footprint,obstacles,runs);
+		break;
+	default:
+	case MAP_ANY:
+		drawFootprint<AnyDim>(footprint,obstacles,runs);
+	}
+}
+
+template <class Dim>
+void PlayoutState::drawFootprint(footprint_t& footprint, board_t& obstacles, footprint_t& runs)
+//footprintAt everywhere at once: a tank's leading edge is a run of 5 cells
+//across a row or column, so OR those runs together first.
+{
+	int x,y,o,f,edge;
+	const int maxx = Dim::maxX(*this);
+	const int miny = Dim::minY(*this);
+	const int maxy = Dim::maxY(*this);
+	//Cells (x,y-2)..(x,y+2) in the high byte, (x-2,y)..(x+2,y) in the low byte
+	for (x = min_x; x < maxx; x++) {
+		for (y = miny; y < maxy; y++) {
+			runs[x][y] = 0;
+			if (y > miny+1 && y < maxy-2) {
+				runs[x][y] |= (obstacles[x][y-2] | obstacles[x][y-1] | obstacles[x][y]
+						| obstacles[x][y+1] | obstacles[x][y+2]) << 8;
+			}
+			if (x > min_x+1 && x < maxx-2) {
+				runs[x][y] |= obstacles[x-2][y] | obstacles[x-1][y] | obstacles[x][y]
+						| obstacles[x+1][y] | obstacles[x+2][y];
+			}
+		}
+	}
+	footprint.fill(0);
+	for (x = min_x+2; x < maxx-2; x++) {
+		for (y = miny+2; y < maxy-2; y++) {
+			f = 0;
+			for (o = 0; o < 4; o++) {
+				//An edge past the bounds can only be turned away from
+				if (!Dim::insideBounds(*this,x+FIRE_LOOKUP(o,O_X),y+FIRE_LOOKUP(o,O_Y))) {
+					f |= F_ROTATE(o);
+					continue;
+				}
+				edge = runs[x+FIRE_LOOKUP(o,O_X)][y+FIRE_LOOKUP(o,O_Y)];
+				edge = (o < O_LEFT) ? (edge & 0xff) : (edge >> 8);
+				if (Dim::isTankInsideBounds(*this,x+O_LOOKUP(o,O_X),y+O_LOOKUP(o,O_Y))) {
+					f |= (edge & PATH_BLOCKS) ? 0 : F_MOVE(o);
+					f |= (!(edge & B_OOB) && (obstacles[x+FIRE_LOOKUP(o,O_X)][y+FIRE_LOOKUP(o,O_Y)] & B_WALL)) ? F_CLEARABLE(o) : 0;
+				}
+				f |= (edge & (B_WALL|B_OOB)) ? F_ROTATE(o) : 0;
+			}
+			edge = (runs[x-2][y] | runs[x-1][y] | runs[x][y] | runs[x+1][y] | runs[x+2][y]) >> 8;
+			f |= (edge & B_OOB) ? F_EXPOSED : 0;
+			footprint[x][y] = (uint16_t)f;
+		}
+	}
+}
+
+void PlayoutState::seedBase(const int player, PathQueue& frontier, board_t& obstacles)
 {
 	int i,o;
 	Tank t;
@@ -730,91 +1006,728 @@ void PlayoutState::seedBase(const int player, priority_queue<Tank>& frontier, bo
 	}
 }
 
-void PlayoutState::findPath(priority_queue<Tank>& frontier, costmatrix_t& costmatrix, board_t& obstacles)
+//What findPath may relax: anything, or only the states inside a PathBox
+struct NoClip {
+	bool contains(const int, const int) const { return true; }
+};
+
+void PlayoutState::findPath(PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint)
 {
-	Tank t,g;
+	switch (mapSize()) {
+	case MAP_81X81:
+		findPath<Map81x81>(frontier,costmatrix,footprint,NoClip());
+		break;
+	default:
+	case MAP_ANY:
+		findPath<AnyDim>(frontier,costmatrix,footprint,NoClip());
+	}
+}
+
+template <class Dim, class Clip>
+void PlayoutState::findPath(PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint, const Clip& clip)
+{
+	Tank g;
+	int tx,ty,to,f;
 	//Flood-fill backward to determine shortest greedy path
-	while (!frontier.empty()) {
-		g = frontier.top();
-		frontier.pop();
+	frontier.begin(costmatrix);
+	while (frontier.pop(g)) {
 #if ASSERT
 		if (!isTankInsideBounds(g.x,g.y)) {
 			cerr << "Tank OOB! x: " << g.x << " y: " << g.y << endl;
 		}
 #endif
-		if (g.cost < costmatrix[g.x][g.y][g.o]) {
-			costmatrix[g.x][g.y][g.o] = g.cost;
-			t.x = g.x - O_LOOKUP(g.o,O_X);
-			t.y = g.y - O_LOOKUP(g.o,O_Y);
-			if (isTankInsideBounds(t.x,t.y)) {
-				if (canMove(t.x,t.y,g.o,obstacles)) {
-					//Tank can move from t to g: no obstacles.
-					t.cost = g.cost+1; //Move
-					for (t.o = 0; t.o < 4; t.o++) {
-						if (t.cost < costmatrix[t.x][t.y][t.o]) {
-							frontier.push(t);
+		tx = g.x - O_LOOKUP(g.o,O_X);
+		ty = g.y - O_LOOKUP(g.o,O_Y);
+		if (Dim::isTankInsideBounds(*this,tx,ty) && clip.contains(tx,ty)) {
+			f = footprint[tx][ty];
+			if (f & F_MOVE(g.o)) {
+				//Tank can move from t to g: no obstacles.
+				for (to = 0; to < 4; to++) {
+					frontier.relax(tx,ty,to,g.cost+1); //Move
+				}
+			} else {
+				if (f & F_CLEARABLE(g.o)) {
+					//Tank can move from t to g: it needs to whack the wall
+					for (to = 0; to < 4; to++) {
+						if (to == g.o) {
+							//It's facing the wall
+							frontier.relax(tx,ty,to,g.cost+2); //Fire+Move
+						} else {
+							//It's not facing the wall
+							frontier.relax(tx,ty,to,g.cost+3); //Turn+Fire+Move
 						}
 					}
-				} else {
-					if (clearablePath(t.x,t.y,g.o,obstacles)) {
-						//Tank can move from t to g: it needs to whack the wall
-						for (t.o = 0; t.o < 4; t.o++) {
-							if (t.o == g.o) {
-								//It's facing the wall
-								t.cost = g.cost+2; //Fire+Move
-							} else {
-								//It's not facing the wall
-								t.cost = g.cost+3; //Turn+Fire+Move
-							}
-							if (t.cost < costmatrix[t.x][t.y][t.o]) {
-								frontier.push(t);
+				}
+			}
+		}
+		if (clip.contains(g.x,g.y) && (footprint[g.x][g.y] & F_ROTATE(g.o))) {
+			//Tank can rotate on to g
+			for (to = 0; to < 4; to++) {
+				frontier.relax(g.x,g.y,to,g.cost+1); //Turn
+			}
+		}
+	}
+}
+
+int PlayoutState::settledCost(const int x, const int y, const int to, costmatrix_t& costmatrix, footprint_t& footprint)
+//The cost findPath would give (x,y,to), going by its neighbours' costs
+{
+	int o,c,best = INT_MAX;
+	int f = footprint[x][y];
+	for (o = 0; o < 4; o++) {
+		c = costmatrix(x+O_LOOKUP(o,O_X),y+O_LOOKUP(o,O_Y),o);
+		if (c != INT_MAX) {
+			if (f & F_MOVE(o)) {
+				best = min(best,c+1); //Move
+			} else if (f & F_CLEARABLE(o)) {
+				best = min(best,c+((to == o) ? 2 : 3)); //(Turn+)Fire+Move
+			}
+		}
+		c = costmatrix(x,y,o);
+		if (o != to && c != INT_MAX && (f & F_ROTATE(o))) {
+			best = min(best,c+1); //Turn
+		}
+	}
+	return best;
+}
+
+bool PlayoutState::repairPath(PathQueue& frontier, costmatrix_t& costmatrix, board_t& before, board_t& after, footprint_t& footprint, const int player)
+//Bring a fill against before up to date with after, without starting over.
+//Only tanks within PATH_REACH of a changed cell can move differently. If one of
+//those loses the move its cost relied on, it gets knocked out (INT_MAX), and so
+//does everything whose cost relied on it. The knocked out states are seeded with
+//what their neighbours say, together with the states whose moves got cheaper,
+//and findPath takes it from there. footprint goes from before's to after's
+//along the way. Returns false (and leaves costmatrix and footprint in a mess)
+//if too much got knocked out to be worth it.
+{
+	int i,j,k,n,m,x,y,o,to,c,s,w,f;
+	bool moved;
+	Tank t;
+	Tank* seed = &frontier.seed[0];
+
+	//seedBase always lists the same states in the same order
+	frontier.num_seeds = 0;
+	seedBase(player,frontier,before);
+	n = frontier.num_seeds;
+	seedBase(player,frontier,after);
+	//Keep this tick's seeds in front. The states to knock out go from n to m,
+	//starting with those relying on a seed that went up.
+	m = n;
+	for (i = 0; i < n; i++) {
+		t = seed[i];
+		seed[i] = seed[n+i];
+		if (seed[i].cost > t.cost && costmatrix(t.x,t.y,t.o) == t.cost) {
+			seed[m] = t;
+			m++;
+		}
+	}
+
+	frontier.dirty.fill(0);
+	for (x = 0; x < before.width; x++) {
+		for (y = 0; y < before.height; y++) {
+			if ((before[x][y] ^ after[x][y]) & PATH_BLOCKS) {
+				for (i = max(x-PATH_REACH,min_x+2); i <= min(x+PATH_REACH,max_x-3); i++) {
+					for (j = max(y-PATH_REACH,min_y+2); j <= min(y+PATH_REACH,max_y-3); j++) {
+						frontier.dirty[i][j] = 1;
+					}
+				}
+			}
+		}
+	}
+	frontier.before = footprint;
+	for (x = min_x+2; x < max_x-2; x++) {
+		for (y = min_y+2; y < max_y-2; y++) {
+			if (frontier.dirty[x][y]) {
+				footprint[x][y] = (uint16_t)footprintAt(x,y,after);
+			}
+		}
+	}
+
+	//Moves that went up (or away) and were the cheapest way forward
+	for (x = min_x+2; x < max_x-2; x++) {
+		for (y = min_y+2; y < max_y-2; y++) {
+			if (!frontier.dirty[x][y]) {
+				continue;
+			}
+			f = frontier.before[x][y];
+			for (o = 0; o < 4; o++) {
+				c = costmatrix(x+O_LOOKUP(o,O_X),y+O_LOOKUP(o,O_Y),o);
+				if (c != INT_MAX && !(footprint[x][y] & F_MOVE(o))) {
+					moved = (f & F_MOVE(o)) != 0;
+					if (moved || ((f & F_CLEARABLE(o)) && !(footprint[x][y] & F_CLEARABLE(o)))) {
+						for (to = 0; to < 4; to++) {
+							w = moved ? 1 : ((to == o) ? 2 : 3);
+							if (costmatrix(x,y,to) == c+w && m < frontier.max_seeds) {
+								seed[m].x = x;
+								seed[m].y = y;
+								seed[m].o = to;
+								seed[m].cost = c+w;
+								m++;
 							}
 						}
 					}
 				}
+				c = costmatrix(x,y,o);
+				if (c != INT_MAX && (f & F_ROTATE(o)) && !(footprint[x][y] & F_ROTATE(o))) {
+					for (to = 0; to < 4; to++) {
+						if (to != o && costmatrix(x,y,to) == c+1 && m < frontier.max_seeds) {
+							seed[m].x = x;
+							seed[m].y = y;
+							seed[m].o = to;
+							seed[m].cost = c+1;
+							m++;
+						}
+					}
+				}
 			}
-			if (canRotate(g.x,g.y,g.o,obstacles)) {
-				//Tank can rotate on to g
-				t.x = g.x;
-				t.y = g.y;
-				t.cost = g.cost+1; //Turn
-				for (t.o = 0; t.o < 4; t.o++) {
-					if (t.cost < costmatrix[t.x][t.y][t.o]) {
-						frontier.push(t);
+		}
+	}
+	if (m >= frontier.max_seeds) {
+		frontier.num_seeds = 0;
+		return false;
+	}
+
+	//Knock them out, skipping doubles
+	k = n;
+	for (i = n; i < m; i++) {
+		s = PATH_STATE(path_shift,seed[i].x,seed[i].y,seed[i].o);
+		if (costmatrix(s) != INT_MAX) {
+			costmatrix.set(s,INT_MAX);
+			seed[k] = seed[i];
+			k++;
+		}
+	}
+	m = k;
+	//and everything that was relying on them
+	for (k = n; k < m; k++) {
+		t = seed[k];
+		x = t.x - O_LOOKUP(t.o,O_X);
+		y = t.y - O_LOOKUP(t.o,O_Y);
+		if (isTankInsideBounds(x,y)) {
+			f = frontier.before[x][y];
+			moved = (f & F_MOVE(t.o)) != 0;
+			if (moved || (f & F_CLEARABLE(t.o))) {
+				for (to = 0; to < 4; to++) {
+					s = PATH_STATE(path_shift,x,y,to);
+					w = moved ? 1 : ((to == t.o) ? 2 : 3);
+					if (costmatrix(s) != INT_MAX && costmatrix(s) == t.cost+w) {
+						if (m == frontier.max_seeds) {
+							frontier.num_seeds = 0;
+							return false;
+						}
+						seed[m].x = x;
+						seed[m].y = y;
+						seed[m].o = to;
+						seed[m].cost = costmatrix(s);
+						costmatrix.set(s,INT_MAX);
+						m++;
+					}
+				}
+			}
+		}
+		if (frontier.before[t.x][t.y] & F_ROTATE(t.o)) {
+			for (to = 0; to < 4; to++) {
+				s = PATH_STATE(path_shift,t.x,t.y,to);
+				if (costmatrix(s) != INT_MAX && costmatrix(s) == t.cost+1) {
+					if (m == frontier.max_seeds) {
+						frontier.num_seeds = 0;
+						return false;
+					}
+					seed[m].x = t.x;
+					seed[m].y = t.y;
+					seed[m].o = to;
+					seed[m].cost = costmatrix(s);
+					costmatrix.set(s,INT_MAX);
+					m++;
+				}
+			}
+		}
+	}
+
+	//Reseed the knocked out states from whatever's left standing
+	k = n;
+	for (i = n; i < m; i++) {
+		seed[i].cost = settledCost(seed[i].x,seed[i].y,seed[i].o,costmatrix,footprint);
+		if (seed[i].cost != INT_MAX) {
+			seed[k] = seed[i];
+			k++;
+		}
+	}
+	m = k;
+	//Moves that got cheaper
+	for (x = min_x+2; x < max_x-2; x++) {
+		for (y = min_y+2; y < max_y-2; y++) {
+			if (!frontier.dirty[x][y]) {
+				continue;
+			}
+			for (to = 0; to < 4; to++) {
+				c = settledCost(x,y,to,costmatrix,footprint);
+				if (c < costmatrix(x,y,to)) {
+					if (m == frontier.max_seeds) {
+						frontier.num_seeds = 0;
+						return false;
 					}
+					seed[m].x = x;
+					seed[m].y = y;
+					seed[m].o = to;
+					seed[m].cost = c;
+					m++;
 				}
 			}
 		}
 	}
+	frontier.num_seeds = m;
+	findPath(frontier,costmatrix,footprint);
+	return true;
 }
 
-void PlayoutState::updateSimpleUtilityScores(UtilityScores& utility, obstacles_t& obstacles)
+void PlayoutState::fillPath(UtilityScores& utility, const int job, costmatrix_t& costmatrix, board_t& obstacles, const int player)
+//Fill costmatrix with the cost of reaching player's base through obstacles.
+//If the job filled it last tick on the same bounds, only the damage is repaired.
 {
-	int i,j,player,o;
-	priority_queue<Tank> frontier;
+	int i,j,o;
+	int* extent = utility.extent[job];
+	bool repaired = false;
 
-	for (player = 0; player < 2; player++) {
+	if (utility.hierarchical && job >= U_EXPENSIVE(0)) {
+		fillPathHierarchy(utility,job,costmatrix,obstacles,player);
+		return;
+	}
+	if (utility.incremental && extent[0] == min_x && extent[1] == min_y
+			&& extent[2] == max_x && extent[3] == max_y) {
+		utility.unpatchCosts(job,costmatrix);
+		repaired = repairPath(utility.frontier[job],costmatrix,utility.pathboard[job],obstacles,utility.footprint[job],player);
+	}
+	if (!repaired) {
 		for (i = 0; i < max_x; i++) {
 			for (j = 0; j < max_y; j++) {
 				for (o = 0; o < 4; o++) {
-					utility.simplecost[player][i][j][o] = INT_MAX;
+					costmatrix.set(i,j,o,INT_MAX);
 				}
 			}
 		}
+		drawFootprint(utility.footprint[job],obstacles,utility.frontier[job].before);
+		seedBase(player,utility.frontier[job],obstacles);
+		findPath(utility.frontier[job],costmatrix,utility.footprint[job]);
 	}
+	rememberFill(utility,job,obstacles);
+}
 
-	//Obstacles are the same for both sides.
-	memcpy(obstacles[0],board,sizeof(board_t));
+void PlayoutState::rememberFill(UtilityScores& utility, const int job, board_t& obstacles)
+//Note down what the job's cost matrix was just filled against, for the next repair
+{
+	int* extent = utility.extent[job];
+	utility.num_patches[job] = 0;
+	utility.pathboard[job] = obstacles;
+	extent[0] = min_x;
+	extent[1] = min_y;
+	extent[2] = max_x;
+	extent[3] = max_y;
+}
 
+inline void clearCosts(costmatrix_t& costmatrix, const PathBox& box, const int shift)
+//Everything in box back to unexplored
+{
+	int x,y,o;
+	for (x = box.x0; x < box.x1; x++) {
+		for (y = box.y0; y < box.y1; y++) {
+			for (o = 0; o < 4; o++) {
+				costmatrix.cost[PATH_STATE(shift,x,y,o)] = COST_UNREACHABLE;
+			}
+		}
+	}
+}
+
+void PlayoutState::fillPathHierarchy(UtilityScores& utility, const int job, costmatrix_t& costmatrix, board_t& obstacles, const int player)
+//fillPath for big maps: findPath only covers the clusters around the tank,
+//seeded where they border the rest by searchHierarchy. Clusters whose
+//footprint or seeds changed since the last fill get their portals placed
+//again, and anything those moved gets relinked once a search needs it.
+//Everything outside the window reads INT_MAX.
+{
+	int i,j,x,y,c,n,cx,cy,f,last;
+	int* extent = utility.extent[job];
+	PathHierarchy& h = utility.hierarchy[job-U_EXPENSIVE(0)];
+	PathQueue& frontier = utility.frontier[job];
+	footprint_t& footprint = utility.footprint[job];
+	board_t& before = utility.pathboard[job];
+	TankState& t = tank[job-U_EXPENSIVE(0)];
+	Tank* seed = &frontier.seed[0];
+	Tank edge;
+	PathBox window;
+	bool rebuild = (h.bounds[2] == 0 || h.bounds[1] != min_y || h.bounds[3] != max_y);
+
+	//Take back the last fill, unless patches got lost (see patchCost)
+	if (!rebuild && equal(extent,extent+4,h.bounds)) {
+		utility.unpatchCosts(job,costmatrix);
+		clearCosts(costmatrix,h.window,path_shift);
+	} else {
+		fill(costmatrix.cost.begin(),costmatrix.cost.end(),(uint16_t)COST_UNREACHABLE);
+		utility.num_patches[job] = 0;
+	}
+
+	frontier.num_seeds = 0;
+	seedBase(player,frontier,obstacles);
+	if (rebuild) {
+		drawFootprint(footprint,obstacles,frontier.before);
+		for (c = 0; c < (int)h.cluster.size(); c++) {
+			h.cluster[c].dirty = true;
+		}
+	} else {
+		//Footprints the changes reach, as in repairPath. The endgame moving
+		//the bounds in changes the ones along the old and new edges.
+		frontier.dirty.fill(0);
+		for (x = 0; x < before.width; x++) {
+			if ((x >= min(h.bounds[0],min_x) && x < max(h.bounds[0],min_x)+2)
+					|| (x >= min(h.bounds[2],max_x)-2 && x < max(h.bounds[2],max_x))) {
+				for (i = max(x-PATH_REACH,0); i <= min(x+PATH_REACH,board.width-1); i++) {
+					fill(frontier.dirty[i],frontier.dirty[i]+board.height,1);
+				}
+				continue;
+			}
+			for (y = 0; y < before.height; y++) {
+				if ((before[x][y] ^ obstacles[x][y]) & PATH_BLOCKS) {
+					for (i = max(x-PATH_REACH,0); i <= min(x+PATH_REACH,board.width-1); i++) {
+						for (j = max(y-PATH_REACH,0); j <= min(y+PATH_REACH,board.height-1); j++) {
+							frontier.dirty[i][j] = 1;
+						}
+					}
+				}
+			}
+		}
+		for (x = 0; x < board.width; x++) {
+			for (y = 0; y < board.height; y++) {
+				if (frontier.dirty[x][y]) {
+					f = footprintAt(x,y,obstacles);
+					if (f != footprint[x][y]) {
+						footprint[x][y] = (uint16_t)f;
+						h.cluster[h.clusterAt(x,y)].dirty = true;
+					}
+				}
+			}
+		}
+		//seedBase always lists the same states in the same order
+		n = max(frontier.num_seeds,(int)h.seed.size());
+		for (i = 0; i < n; i++) {
+			if (i < frontier.num_seeds && i < (int)h.seed.size() && seed[i].x == h.seed[i].x
+					&& seed[i].y == h.seed[i].y && seed[i].o == h.seed[i].o && seed[i].cost == h.seed[i].cost) {
+				continue;
+			}
+			if (i < frontier.num_seeds) {
+				h.cluster[h.clusterAt(seed[i].x,seed[i].y)].dirty = true;
+			}
+			if (i < (int)h.seed.size()) {
+				h.cluster[h.clusterAt(h.seed[i].x,h.seed[i].y)].dirty = true;
+			}
+		}
+	}
+	h.seed.assign(seed,seed+frontier.num_seeds);
+
+	//Portals along the changed clusters' borders, and whoever they lead to
+	for (c = 0; c < (int)h.cluster.size(); c++) {
+		if (!h.cluster[c].dirty) {
+			continue;
+		}
+		h.invalidate(c);
+		if (c % h.height > 0 && placePortals(h,footprint,c-1,1)) {
+			h.invalidate(c-1);
+		}
+		if (c % h.height < h.height-1 && placePortals(h,footprint,c,1)) {
+			h.invalidate(c+1);
+		}
+		if (c >= h.height && placePortals(h,footprint,c-h.height,0)) {
+			h.invalidate(c-h.height);
+		}
+		if (c < (h.width-1)*h.height && placePortals(h,footprint,c,0)) {
+			h.invalidate(c+h.height);
+		}
+		h.cluster[c].dirty = false;
+	}
+	//Seeds come in lines, so a cluster's are mostly next to each other
+	last = -1;
+	for (i = 0; i < (int)h.seed.size(); i++) {
+		c = h.clusterAt(h.seed[i].x,h.seed[i].y);
+		if (c != last && !h.cluster[c].scored) {
+			scoreCluster(h,frontier,costmatrix,footprint,c);
+		}
+		last = c;
+	}
+
+	//The tank's cluster and HPA_WINDOW more on every side
+	cx = min(max(t.x,0),board.width-1)/HPA_CLUSTER;
+	cy = min(max(t.y,0),board.height-1)/HPA_CLUSTER;
+	window.x0 = max(cx-HPA_WINDOW,0)*HPA_CLUSTER;
+	window.y0 = max(cy-HPA_WINDOW,0)*HPA_CLUSTER;
+	window.x1 = min((cx+HPA_WINDOW+1)*HPA_CLUSTER,board.width);
+	window.y1 = min((cy+HPA_WINDOW+1)*HPA_CLUSTER,board.height);
+	searchHierarchy(h,frontier,costmatrix,footprint,window);
+	//findPath over it, from the goal and the nodes leading out of it
+	frontier.num_seeds = 0;
+	for (i = 0; i < (int)h.seed.size(); i++) {
+		if (window.contains(h.seed[i].x,h.seed[i].y)) {
+			frontier.push(h.seed[i]);
+		}
+	}
+	for (i = 0; i < (int)h.target.size(); i++) {
+		n = h.target[i];
+		if (h.dist[n] != INT_MAX) {
+			edge = h.node[n];
+			edge.cost = h.dist[n];
+			frontier.push(edge);
+		}
+	}
+	findPath<AnyDim>(frontier,costmatrix,footprint,window);
+	//Those were only there to seed it
+	for (i = 0; i < (int)h.target.size(); i++) {
+		n = h.target[i];
+		costmatrix.set(h.node[n].x,h.node[n].y,h.node[n].o,INT_MAX);
+		h.wanted[n] = 0;
+	}
+	h.window = window;
+	h.bounds[0] = min_x;
+	h.bounds[1] = min_y;
+	h.bounds[2] = max_x;
+	h.bounds[3] = max_y;
+	rememberFill(utility,job,obstacles);
+}
+
+bool PlayoutState::placePortals(PathHierarchy& h, footprint_t& footprint, const int c, const int below)
+//Portals along the border right of (or below) cluster c, true if they moved.
+//A run of cells a tank can cross the border at gets one every HPA_GAP cells.
+{
+	int i,j,k,p,end,run,pos;
+	bool changed = false;
+	Tank node[HPA_SLOTS];
+	Tank* old = &h.node[(2*c+below)*HPA_SLOTS];
+	PathBox box = h.clusterBox(c,board.width,board.height);
+	const int in = below ? O_DOWN : O_RIGHT;
+	const int out = O_OPPOSITE(in);
+	const int crossing[2] = {F_MOVE(in)|F_CLEARABLE(in),F_MOVE(out)|F_CLEARABLE(out)};
+	//Last line of c and first line of the next cluster, and how far along they go
+	const int a = below ? box.y1-1 : box.x1-1;
+	const int from = below ? box.x0 : box.y0;
+	const int to = below ? box.x1 : box.y1;
+	int f[2];
+
+	for (p = 0; p < HPA_SLOTS; p++) {
+		node[p].x = -1;
+		node[p].y = -1;
+		node[p].o = 0;
+		node[p].cost = 0;
+	}
+	p = 0;
+	for (i = from; i < to && p < HPA_PORTALS; i = end+1) {
+		for (end = i; end < to; end++) {
+			f[0] = below ? footprint[end][a] : footprint[a][end];
+			f[1] = below ? footprint[end][a+1] : footprint[a+1][end];
+			if (!(f[0] & crossing[0]) && !(f[1] & crossing[1])) {
+				break;
+			}
+		}
+		run = end-i;
+		k = (run+HPA_GAP-1)/HPA_GAP;
+		for (j = 0; j < k && p < HPA_PORTALS; j++, p++) {
+			pos = i+(2*j+1)*run/(2*k);
+			f[0] = below ? footprint[pos][a] : footprint[a][pos];
+			f[1] = below ? footprint[pos][a+1] : footprint[a+1][pos];
+			if (f[0] & crossing[0]) {
+				node[2*p].x = below ? pos : a+1;
+				node[2*p].y = below ? a+1 : pos;
+				node[2*p].o = in;
+			}
+			if (f[1] & crossing[1]) {
+				node[2*p+1].x = below ? pos : a;
+				node[2*p+1].y = below ? a : pos;
+				node[2*p+1].o = out;
+			}
+		}
+	}
+	for (p = 0; p < HPA_SLOTS; p++) {
+		if (old[p].x != node[p].x || old[p].y != node[p].y || old[p].o != node[p].o) {
+			old[p] = node[p];
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+void PlayoutState::linkCluster(PathHierarchy& h, PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint, const int c)
+//What it costs to get from each node arriving in cluster c to each node
+//leaving it, with findPath kept inside. costmatrix is only scratch here: it
+//has to be INT_MAX over c, and it's left that way.
+{
+	int i,l,n,num_arrivals = 0;
+	int arrival[HPA_LOCAL];
+	Tank t;
+	PathCluster& k = h.cluster[c];
+	PathBox box = h.clusterBox(c,board.width,board.height);
+
+	fill(&k.edge[0][0],&k.edge[0][0]+HPA_LOCAL*HPA_LOCAL,(uint16_t)COST_UNREACHABLE);
+	k.linked = true;
+	for (l = 0; l < HPA_LOCAL; l++) {
+		n = h.localNode(c,l);
+		if (n >= 0 && h.node[n].x >= 0 && box.contains(h.node[n].x,h.node[n].y)) {
+			arrival[num_arrivals] = l;
+			num_arrivals++;
+		}
+	}
+	for (l = 0; l < HPA_LOCAL && num_arrivals > 0; l++) {
+		n = h.localNode(c,l);
+		if (n < 0 || h.node[n].x < 0 || box.contains(h.node[n].x,h.node[n].y)) {
+			continue;
+		}
+		t = h.node[n];
+		t.cost = 0;
+		frontier.num_seeds = 0;
+		frontier.push(t);
+		findPath<AnyDim>(frontier,costmatrix,footprint,box);
+		for (i = 0; i < num_arrivals; i++) {
+			t = h.node[h.localNode(c,arrival[i])];
+			k.edge[arrival[i]][l] = costmatrix.cost[PATH_STATE(path_shift,t.x,t.y,t.o)];
+		}
+		clearCosts(costmatrix,box,path_shift);
+		t = h.node[n];
+		costmatrix.set(t.x,t.y,t.o,INT_MAX);
+	}
+}
+
+void PlayoutState::scoreCluster(PathHierarchy& h, PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint, const int c)
+//What it costs to get from each node arriving in cluster c to the goal, with
+//findPath kept inside. costmatrix is scratch, as for linkCluster.
+{
+	int i,l,n;
+	Tank t;
+	PathCluster& k = h.cluster[c];
+	PathBox box = h.clusterBox(c,board.width,board.height);
+
+	fill(k.goal,k.goal+HPA_LOCAL,(uint16_t)COST_UNREACHABLE);
+	k.scored = true;
+	frontier.num_seeds = 0;
+	for (i = 0; i < (int)h.seed.size(); i++) {
+		if (box.contains(h.seed[i].x,h.seed[i].y)) {
+			frontier.push(h.seed[i]);
+		}
+	}
+	findPath<AnyDim>(frontier,costmatrix,footprint,box);
+	for (l = 0; l < HPA_LOCAL; l++) {
+		n = h.localNode(c,l);
+		if (n >= 0 && h.node[n].x >= 0 && box.contains(h.node[n].x,h.node[n].y)) {
+			t = h.node[n];
+			k.goal[l] = costmatrix.cost[PATH_STATE(path_shift,t.x,t.y,t.o)];
+		}
+	}
+	clearCosts(costmatrix,box,path_shift);
+}
+
+inline int windowDistance(const Tank& t, const PathBox& box)
+//Steps from t into box at the least, searchHierarchy's A* heuristic
+{
+	return max(max(box.x0-t.x,t.x-box.x1+1),0)+max(max(box.y0-t.y,t.y-box.y1+1),0);
+}
+
+void PlayoutState::searchHierarchy(PathHierarchy& h, PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint, const PathBox& window)
+//A* over the nodes, back from the goal towards window, until the nodes leading
+//out of window are settled. Those end up in target. Once one is, the rest only
+//get until the cost of going round the window on top of that: any dearer, and
+//going through the first is cheaper. The clusters it goes through get linked
+//on the way, so costmatrix is scratch, as for linkCluster.
+{
+	int i,c,l,la,n,m,d,e,cx,cy,last,pending;
+	int limit = INT_MAX;
+	greater< pair<int,int> > later;
+	vector< pair<int,int> >& heap = h.heap;
+
+	h.target.clear();
+	for (cx = window.x0/HPA_CLUSTER; cx*HPA_CLUSTER < window.x1; cx++) {
+		for (cy = window.y0/HPA_CLUSTER; cy*HPA_CLUSTER < window.y1; cy++) {
+			c = cx*h.height+cy;
+			for (l = 0; l < HPA_LOCAL; l++) {
+				n = h.localNode(c,l);
+				if (n >= 0 && h.node[n].x >= 0 && !window.contains(h.node[n].x,h.node[n].y)) {
+					h.wanted[n] = 1;
+					h.target.push_back(n);
+				}
+			}
+		}
+	}
+	pending = (int)h.target.size();
+	fill(h.dist.begin(),h.dist.end(),INT_MAX);
+	fill(h.closed.begin(),h.closed.end(),0);
+	heap.clear();
+	last = -1;
+	for (i = 0; i < (int)h.seed.size(); i++) {
+		c = h.clusterAt(h.seed[i].x,h.seed[i].y);
+		for (l = 0; l < HPA_LOCAL && c != last; l++) {
+			d = h.cluster[c].goal[l];
+			if (d != COST_UNREACHABLE) {
+				n = h.localNode(c,l);
+				if (d < h.dist[n]) {
+					h.dist[n] = d;
+					heap.push_back(make_pair(d+windowDistance(h.node[n],window),n));
+					push_heap(heap.begin(),heap.end(),later);
+				}
+			}
+		}
+		last = c;
+	}
+	while (pending > 0 && !heap.empty()) {
+		m = heap.front().second;
+		if (heap.front().first > limit) {
+			break;
+		}
+		pop_heap(heap.begin(),heap.end(),later);
+		heap.pop_back();
+		if (h.closed[m]) {
+			continue;
+		}
+		h.closed[m] = 1;
+		d = h.dist[m];
+		if (h.wanted[m]) {
+			pending--;
+			limit = min(limit,d+HPA_DETOUR(window));
+		}
+		//Everything arriving in the cluster m leaves
+		c = h.exitCluster(m,l);
+		if (!h.cluster[c].linked) {
+			linkCluster(h,frontier,costmatrix,footprint,c);
+		}
+		for (la = 0; la < HPA_LOCAL; la++) {
+			e = h.cluster[c].edge[la][l];
+			if (e != COST_UNREACHABLE) {
+				n = h.localNode(c,la);
+				if (d+e < h.dist[n]) {
+					h.dist[n] = d+e;
+					heap.push_back(make_pair(d+e+windowDistance(h.node[n],window),n));
+					push_heap(heap.begin(),heap.end(),later);
+				}
+			}
+		}
+	}
+}
+
+void PlayoutState::updateSimpleUtilityScores(UtilityScores& utility)
+{
+	int player;
+	utility.resize(board.width,board.height);
 	for (player = 0; player < 2; player++) {
-		//Just go after the base
-		seedBase(1-player,frontier,obstacles[0]);
-		findPath(frontier,utility.simplecost[player],obstacles[0]);
+		updateSimpleUtilityScore(utility,player);
 	}
+}
+
+void PlayoutState::updateSimpleUtilityScore(UtilityScores& utility, const int player)
+{
+	//Obstacles are the same for both sides: the board itself.
+	//Just go after the base
+	fillPath(utility,U_SIMPLE(player),utility.simplecost[player],board,1-player);
+	patchSimpleUtilityScore(utility,player);
+}
 
+void PlayoutState::patchSimpleUtilityScore(UtilityScores& utility, const int player)
+{
+	int o;
 	for (o = 0; o < 4; o++) {
-		utility.simplecost[PLAYER0][base[PLAYER1].x][base[PLAYER1].y][o] = 0;
-		utility.simplecost[PLAYER1][base[PLAYER0].x][base[PLAYER0].y][o] = 0;
+		utility.patchCost(U_SIMPLE(player),utility.simplecost[player],base[1-player].x,base[1-player].y,o,0);
 	}
 }
 
@@ -856,148 +1769,162 @@ bool PlayoutState::lineOfSight(const int sx, const int sy, const int o, const in
 
 void PlayoutState::updateExpensiveUtilityScores(UtilityScores& utility, obstacles_t& obstacles)
 {
-	int o,i,j,tankid,comradeid,traveldistance[4];
-	//int enemyid;
-	int targetx,targety,deltax,deltay,playerid;
-	priority_queue<Tank> frontier;
-
+	int tankid;
+	utility.resize(board.width,board.height);
+	//Tank 0 has priority: tank 1 needs its path first, same for tanks 2 and 3.
 	for (tankid = 0; tankid < 4; tankid++) {
-		for (i = 0; i < max_x; i++) {
-			for (j = 0; j < max_y; j++) {
-				for (o = 0; o < 4; o++) {
-					utility.expensivecost[tankid][i][j][o] = INT_MAX;
-				}
+		updateExpensiveUtilityScore(utility,obstacles,tankid);
+	}
+}
+
+void PlayoutState::updateExpensiveUtilityScore(UtilityScores& utility, obstacles_t& obstacles, const int tankid)
+{
+	drawExpensiveObstacles(utility,obstacles,tankid);
+	fillPath(utility,U_EXPENSIVE(tankid),utility.expensivecost[tankid],obstacles[tankid],1-tankid/2);
+	patchExpensiveUtilityScore(utility,tankid);
+}
+
+void PlayoutState::drawExpensiveObstacles(UtilityScores& utility, obstacles_t& obstacles, const int tankid)
+//The board as tank tankid sees it: its comrade, the comrade's path and the lanes
+//bullets and enemy barrels cover are all in the way.
+{
+	int o,i,j,comradeid,traveldistance[4];
+	//int enemyid;
+	int targetx,targety,deltax,deltay;
+	int playerid = tankid/2;
+
+	//Each tank has a different set of obstacles
+	obstacles[tankid] = board;
+	/*
+	for (enemyid = (1-playerid)*2; enemyid < ((1-playerid)*2+2); enemyid++) {
+		if (tank[enemyid].active) {
+			if (abs(tank[enemyid].x - tank[tankid].x)
+					+ abs(tank[enemyid].y - tank[tankid].y) < TANK_PROXIMITY_WARNING) {
+				drawTankObstacle(enemyid,obstacles[tankid]);
 			}
 		}
-	}
-	for (playerid = 0; playerid < 2; playerid++) {
-		for (tankid = (playerid*2); tankid < (playerid*2+2); tankid++) {
-			//Each tank has a different set of obstacles
-			memcpy(obstacles[tankid],board,sizeof(board_t));
-			/*
-			for (enemyid = (1-playerid)*2; enemyid < ((1-playerid)*2+2); enemyid++) {
-				if (tank[enemyid].active) {
-					if (abs(tank[enemyid].x - tank[tankid].x)
-							+ abs(tank[enemyid].y - tank[tankid].y) < TANK_PROXIMITY_WARNING) {
-						drawTankObstacle(enemyid,obstacles[tankid]);
-					}
+	}*/
+	comradeid = tankid^1;
+	//Friendly tank counts as immovable obstacle
+	if (tank[comradeid].active) {
+		drawTankObstacle(comradeid,obstacles[tankid]);
+		if (tankid & 1) {
+			//Tank 0 has priority.
+			targetx = tank[comradeid].x;
+			targety = tank[comradeid].y;
+			for (i = 0; i < max_y; i++) {
+				//Bail out at 80+ moves ahead.
+				o = bestO(targetx,targety,utility.expensivecost[comradeid]);
+				targetx += O_LOOKUP(o,O_X);
+				targety += O_LOOKUP(o,O_Y);
+				if (utility.expensivecost[comradeid](targetx,targety,o) == INT_MAX) {
+					//No way on, or off the window fillPathHierarchy refined
+					break;
 				}
-			}*/
-			comradeid = tankid^1;
-			//Friendly tank counts as immovable obstacle
-			if (tank[comradeid].active) {
-				drawTankObstacle(comradeid,obstacles[tankid]);
-				if (tankid & 1) {
-					//Tank 0 has priority.
-					targetx = tank[comradeid].x;
-					targety = tank[comradeid].y;
-					for (i = 0; i < max_y; i++) {
-						//Bail out at 80+ moves ahead.
-						o = bestO(targetx,targety,utility.expensivecost[comradeid]);
-						targetx += O_LOOKUP(o,O_X);
-						targety += O_LOOKUP(o,O_Y);
-						drawTankObstacle(targetx,targety,obstacles[tankid]);
-						if (lineOfSight(targetx,targety,o,base[1-playerid].x,base[1-playerid].y)) {
-							break;
-						}
-					}
+				drawTankObstacle(targetx,targety,obstacles[tankid]);
+				if (lineOfSight(targetx,targety,o,base[1-playerid].x,base[1-playerid].y)) {
+					break;
 				}
 			}
-			//Path of bullets count as immovable obstacle
-			for (j = 0; j < 4; j++) {
-				if (bullet[j].active && j != tankid) {
-					targetx = bullet[j].x;
-					targety = bullet[j].y;
-					deltax = O_LOOKUP(bullet[j].o,O_X);
-					deltay = O_LOOKUP(bullet[j].o,O_Y);
-				} else {
-					continue;
-				}
-				for (i = 0; i < max_y/2; i++) {
-					if (insideBounds(targetx,targety)
-							&& !(board[targetx][targety] & (B_WALL|B_OPPOSITE(bullet[j].o)))) {
-						obstacles[tankid][targetx][targety] = B_OOB;
-						targetx += deltax;
-						targety += deltay;
-					} else {
-						break;
-					}
-				}
-				traveldistance[j] = i;
-			}
-
-			for (j = 0; j < 4; j++) {
-				if (j != tankid && j != comradeid && tank[j].active && tank[j].canfire
-						&& (abs(tank[j].x - tank[tankid].x)
-								+ abs(tank[j].y - tank[tankid].y) < TANK_PROXIMITY_WARNING)) {
-					o = tank[j].o;
-					traveldistance[j] = 10;
-					targetx = tank[j].x + FIRE_LOOKUP(o,O_X);
-					targety = tank[j].y + FIRE_LOOKUP(o,O_Y);
-					deltax = O_LOOKUP(o,O_X);
-					deltay = O_LOOKUP(o,O_Y);
-					for (i = 0; i < traveldistance[j]; i++) {
-						if (insideBounds(targetx,targety)
-								&& !(board[targetx][targety] & B_OPPOSITE(bullet[j].o))) {
-							if (board[targetx][targety] & B_WALL) {
-								i*=2;
-							}
-							obstacles[tankid][targetx][targety] = B_OOB;
-							targetx += deltax;
-							targety += deltay;
-						} else {
-							break;
-						}
+		}
+	}
+	//Path of bullets count as immovable obstacle
+	for (j = 0; j < 4; j++) {
+		if (bullet[j].active && j != tankid) {
+			targetx = bullet[j].x;
+			targety = bullet[j].y;
+			deltax = O_LOOKUP(bullet[j].o,O_X);
+			deltay = O_LOOKUP(bullet[j].o,O_Y);
+		} else {
+			continue;
+		}
+		for (i = 0; i < max_y/2; i++) {
+			if (insideBounds(targetx,targety)
+					&& !(board[targetx][targety] & (B_WALL|B_OPPOSITE(bullet[j].o)))) {
+				obstacles[tankid][targetx][targety] = B_OOB;
+				targetx += deltax;
+				targety += deltay;
+			} else {
+				break;
+			}
+		}
+		traveldistance[j] = i;
+	}
+
+	for (j = 0; j < 4; j++) {
+		if (j != tankid && j != comradeid && tank[j].active && tank[j].canfire
+				&& (abs(tank[j].x - tank[tankid].x)
+						+ abs(tank[j].y - tank[tankid].y) < TANK_PROXIMITY_WARNING)) {
+			o = tank[j].o;
+			traveldistance[j] = 10;
+			targetx = tank[j].x + FIRE_LOOKUP(o,O_X);
+			targety = tank[j].y + FIRE_LOOKUP(o,O_Y);
+			deltax = O_LOOKUP(o,O_X);
+			deltay = O_LOOKUP(o,O_Y);
+			for (i = 0; i < traveldistance[j]; i++) {
+				if (insideBounds(targetx,targety)
+						&& !(board[targetx][targety] & B_OPPOSITE(bullet[j].o))) {
+					if (board[targetx][targety] & B_WALL) {
+						i*=2;
 					}
-					traveldistance[j] = 10;
+					obstacles[tankid][targetx][targety] = B_OOB;
+					targetx += deltax;
+					targety += deltay;
+				} else {
+					break;
 				}
 			}
-			seedBase(1-playerid,frontier,obstacles[tankid]);
+			traveldistance[j] = 10;
+		}
+	}
 #if DEBUGOBSTACLES
-			cout << "Obstacles for tank " << tankid << endl;
-			cout << "=======================" << endl;
-			paintObstacles(obstacles[tankid]);
+	cout << "Obstacles for tank " << tankid << endl;
+	cout << "=======================" << endl;
+	paintObstacles(obstacles[tankid]);
 #endif
-			findPath(frontier,utility.expensivecost[tankid],obstacles[tankid]);
-
-			if (tank[tankid].canfire) {
-				//Put down breadcrumbs to turn and fire for active defence
-				for (j = (1-playerid); j < (1-playerid)*2+2; j++) {
-
-					if (bullet[j].active) {
-						targetx = bullet[j].x;
-						targety = bullet[j].y;
-						deltax = O_LOOKUP(bullet[j].o,O_X);
-						deltay = O_LOOKUP(bullet[j].o,O_Y);
-						o = bullet[j].o;
-					} else if (tank[j].active && (abs(tank[j].x - tank[tankid].x)
-							+ abs(tank[j].y - tank[tankid].y) < TANK_PROXIMITY_WARNING)) {
-						targetx = tank[j].x + FIRE_LOOKUP(tank[j].o,O_X);
-						targety = tank[j].y + FIRE_LOOKUP(tank[j].o,O_Y);
-						deltax = O_LOOKUP(tank[j].o,O_X);
-						deltay = O_LOOKUP(tank[j].o,O_Y);
-						o = tank[j].o;
-					} else {
-						continue;
-					}
-					for (i = 0; i < 24; i++) {
-						if (isTankInsideBounds(targetx,targety)
-								&& (board[targetx][targety] & (B_WALL|B_OPPOSITE(o))) == 0) {
-							utility.expensivecost[tankid][targetx][targety][O_OPPOSITE(o)] = (i/2)+1;
-							targetx += deltax;
-							targety += deltay;
-						} else {
-							break;
-						}
-					}
-				}
-			}
+}
 
-			for (o = 0; o < 4; o++) {
-				utility.expensivecost[tankid][base[1-playerid].x][base[1-playerid].y][o] = 0;
+void PlayoutState::patchExpensiveUtilityScore(UtilityScores& utility, const int tankid)
+{
+	int o,i,j;
+	int targetx,targety,deltax,deltay;
+	int playerid = tankid/2;
+
+	if (tank[tankid].canfire) {
+		//Put down breadcrumbs to turn and fire for active defence
+		for (j = (1-playerid); j < (1-playerid)*2+2; j++) {
+			if (bullet[j].active) {
+				targetx = bullet[j].x;
+				targety = bullet[j].y;
+				deltax = O_LOOKUP(bullet[j].o,O_X);
+				deltay = O_LOOKUP(bullet[j].o,O_Y);
+				o = bullet[j].o;
+			} else if (tank[j].active && (abs(tank[j].x - tank[tankid].x)
+					+ abs(tank[j].y - tank[tankid].y) < TANK_PROXIMITY_WARNING)) {
+				targetx = tank[j].x + FIRE_LOOKUP(tank[j].o,O_X);
+				targety = tank[j].y + FIRE_LOOKUP(tank[j].o,O_Y);
+				deltax = O_LOOKUP(tank[j].o,O_X);
+				deltay = O_LOOKUP(tank[j].o,O_Y);
+				o = tank[j].o;
+			} else {
+				continue;
+			}
+			for (i = 0; i < 24; i++) {
+				if (isTankInsideBounds(targetx,targety)
+						&& (board[targetx][targety] & (B_WALL|B_OPPOSITE(o))) == 0) {
+					utility.patchCost(U_EXPENSIVE(tankid),utility.expensivecost[tankid],targetx,targety,O_OPPOSITE(o),(i/2)+1);
+					targetx += deltax;
+					targety += deltay;
+				} else {
+					break;
+				}
 			}
 		}
 	}
+
+	for (o = 0; o < 4; o++) {
+		utility.patchCost(U_EXPENSIVE(tankid),utility.expensivecost[tankid],base[1-playerid].x,base[1-playerid].y,o,0);
+	}
 	//The 4 dirs for each enemy tank
 	/* int tankno;
 	 for (j = 0; j < 5; j++) {
@@ -1022,6 +1949,104 @@ void PlayoutState::updateExpensiveUtilityScores(UtilityScores& utility, obstacle
 	}*/
 }
 
+void PlayoutState::updateGreedyCommands(UtilityScores& utility)
+//Bakes bestC into a table using the walls only: tanks and bullets move around,
+//so greedyC has to check for them on the fly.
+{
+	int x,y,o,d,i,player,hitcost,bx,by,firecost,bestcmd,bestscore,besto;
+	int movecost[4];
+	int start[2],stop[2],step[2];
+	bool clear;
+	BaseState* enemybase;
+
+	//Squares to the first wall, walking in from the edge so each square reuses its neighbour
+	fill(utility.firerange.begin(),utility.firerange.end(),0);
+	for (o = 0; o < 4; o++) {
+		start[O_X] = (O_LOOKUP(o,O_X) > 0) ? max_x-1 : min_x;
+		stop[O_X] = (O_LOOKUP(o,O_X) > 0) ? min_x-1 : max_x;
+		step[O_X] = (O_LOOKUP(o,O_X) > 0) ? -1 : 1;
+		start[O_Y] = (O_LOOKUP(o,O_Y) > 0) ? max_y-1 : min_y;
+		stop[O_Y] = (O_LOOKUP(o,O_Y) > 0) ? min_y-1 : max_y;
+		step[O_Y] = (O_LOOKUP(o,O_Y) > 0) ? -1 : 1;
+		for (x = start[O_X]; x != stop[O_X]; x += step[O_X]) {
+			for (y = start[O_Y]; y != stop[O_Y]; y += step[O_Y]) {
+				if (board[x][y] & B_WALL) {
+					continue;
+				}
+				bx = x + O_LOOKUP(o,O_X);
+				by = y + O_LOOKUP(o,O_Y);
+				utility.firerange[PATH_STATE(path_shift,x,y,o)] = 1;
+				if (insideBounds(bx,by)) {
+					//Saturates: past UCHAR_MAX squares nothing's in range anyway
+					utility.firerange[PATH_STATE(path_shift,x,y,o)] = min(UCHAR_MAX,1+utility.firerange[PATH_STATE(path_shift,bx,by,o)]);
+				}
+			}
+		}
+	}
+
+	for (player = 0; player < 2; player++) {
+		fill(utility.greedycmd[player].begin(),utility.greedycmd[player].end(),G_PACK(C_NONE,C_NONE));
+	}
+	for (player = 0; player < 2; player++) {
+		costmatrix_t& costmatrix = utility.simplecost[player];
+		enemybase = &base[1-player];
+		for (x = min_x; x < max_x; x++) {
+			for (y = min_y; y < max_y; y++) {
+				if (!isTankInsideBounds(x,y)) {
+					continue;
+				}
+				//bestOCMD, but only walls block the way
+				besto = O_UP;
+				for (d = 0; d < 4; d++) {
+					clear = insideBounds(x+MOVEPATH_LOOKUP(d,2,O_X),y+MOVEPATH_LOOKUP(d,2,O_Y));
+					for (i = 0; clear && (i < 5); i++) {
+						clear = !(board[x+MOVEPATH_LOOKUP(d,i,O_X)][y+MOVEPATH_LOOKUP(d,i,O_Y)] & B_WALL);
+					}
+					if (clear) {
+						movecost[d] = costmatrix(x + O_LOOKUP(d,O_X),y + O_LOOKUP(d,O_Y),d);
+					} else {
+						movecost[d] = costmatrix(x,y,d);
+					}
+					if (movecost[d] < movecost[besto]) {
+						besto = d;
+					}
+				}
+				for (o = 0; o < 4; o++) {
+					bestcmd = besto+C_UP;
+					bestscore = movecost[besto];
+					if (costmatrix(x,y,o) == INT_MAX) {
+						//bestC wraps around to INT_MIN here, so nothing beats sitting still
+						bestcmd = C_NONE;
+						bestscore = INT_MIN;
+					} else if (costmatrix(x,y,o)+1 < bestscore) {
+						bestcmd = C_NONE;
+						bestscore = costmatrix(x,y,o)+1;
+					}
+					hitcost = INT_MAX-1;
+					if (lineOfSight(x,y,o,enemybase->x,enemybase->y)) {
+						bx = x + FIRE_LOOKUP(o,O_X);
+						by = y + FIRE_LOOKUP(o,O_Y);
+						i = rayStop(bx,by,o,0,3);
+						if (onBase(1-player,bx + i*O_LOOKUP(o,O_X),by + i*O_LOOKUP(o,O_Y))) {
+							hitcost = (i/2)+wallCost(bx,by,o,i);
+						}
+					}
+					if ((o == besto) && isTankInsideBounds(x + O_LOOKUP(o,O_X),y + O_LOOKUP(o,O_Y)) && clearablePath(x,y,o)) {
+						firecost = min(hitcost,costmatrix(x + O_LOOKUP(o,O_X),y + O_LOOKUP(o,O_Y),o));
+					} else {
+						firecost = hitcost;
+					}
+					if (firecost < bestscore) {
+						utility.greedycmd[player][PATH_STATE(path_shift,x,y,o)] = G_PACK(C_FIRE,bestcmd);
+					} else {
+						utility.greedycmd[player][PATH_STATE(path_shift,x,y,o)] = G_PACK(bestcmd,bestcmd);
+					}
+				}
+			}
+		}
+	}
+}
+
 bool PlayoutState::onBase(const int b, const int x, const int y)
 {
 	return (x == base[b].x && y == base[b].y);
@@ -1029,31 +2054,175 @@ bool PlayoutState::onBase(const int b, const int x, const int y)
 
 bool PlayoutState::onTarget(const int p, const int x, const int y)
 {
-	return (onBase(1-p,x,y) || insideTank((1-p)*2,x,y) || insideTank((1-p)*2+1,x,y));
+	int t = tankAt(x,y);
+	return (onBase(1-p,x,y) || (t >= 0 && t/2 == 1-p));
 }
 
 bool PlayoutState::onFriendly(const int p, const int x, const int y)
 {
-	return (onBase(p,x,y) || insideTank(p,x,y) || insideTank(p+1,x,y));
+	int t = tankAt(x,y);
+	return (onBase(p,x,y) || (t >= 0 && t/2 == p));
 }
 
-bool PlayoutState::incomingBullet(const int x, const int y, const int o)
+int PlayoutState::wallDistance(const int x, const int y, const int o)
+//Steps from (x,y) heading o to the first wall, or off the board if there isn't one
 {
-	int i;
-	bool incoming = false;
-	for (i = 0; i < 4 && !incoming; i++) {
-		incoming = bullet[i].active && (bullet[i].o == (o^1)) && (bullet[i].x == x) && (bullet[i].y == y);
+	int axis = (o < O_LEFT) ? O_Y : O_X;
+	int k = (axis == O_X) ? x : y;
+	int lo = (axis == O_X) ? min_x : min_y;
+	int hi = (axis == O_X) ? max_x : max_y;
+	uint32_t* bits = wallbits[axis][(axis == O_X) ? y : x];
+	uint32_t m;
+	int w = k >> 5;
+	if (!insideBounds(x,y)) {
+		return 0;
+	}
+	if (o == O_DOWN || o == O_RIGHT) {
+		m = bits[w] & (0xffffffffu << (k & 31));
+		while (!m) {
+			w++;
+			if ((w << 5) >= hi) {
+				return hi-k;
+			}
+			m = bits[w];
+		}
+		return min((w << 5) | lowestBit(m),hi)-k;
+	} else {
+		m = bits[w] & (0xffffffffu >> (31-(k & 31)));
+		while (!m) {
+			w--;
+			if (w < 0 || (w << 5)+31 < lo) {
+				return k-lo+1;
+			}
+			m = bits[w];
+		}
+		return k-max((w << 5) | highestBit(m),lo-1);
+	}
+}
+
+int PlayoutState::wallCost(const int x, const int y, const int o, const int n)
+//What bestC charges for the walls in the first n steps from (x,y) heading o:
+//i/2+1 for a wall i steps out. n must stay on the board.
+{
+	int axis = (o < O_LEFT) ? O_Y : O_X;
+	int k = (axis == O_X) ? x : y;
+	uint32_t* bits = wallbits[axis][(axis == O_X) ? y : x];
+	int a = (o == O_DOWN || o == O_RIGHT) ? k : k-n+1;
+	int b = a+n;
+	int w,p,cost = 0;
+	uint32_t m;
+	for (w = a >> 5; n > 0 && w <= (b-1) >> 5; w++) {
+		m = bits[w];
+		if (w == (a >> 5)) {
+			m &= 0xffffffffu << (a & 31);
+		}
+		if (w == ((b-1) >> 5)) {
+			m &= 0xffffffffu >> (31-((b-1) & 31));
+		}
+		while (m) {
+			p = (w << 5) | lowestBit(m);
+			cost += (abs(p-k)/2)+1;
+			m &= m-1;
+		}
+	}
+	return cost;
+}
+
+int PlayoutState::rayStop(const int x, const int y, const int o, const int tanks, const int bases)
+//Steps from (x,y) heading o until it's off the board, inside one of the tanks
+//or on one of the bases picked out by the bits of tanks and bases
+{
+	int i,n,along,across;
+	int dx = O_LOOKUP(o,O_X);
+	int dy = O_LOOKUP(o,O_Y);
+	if (!insideBounds(x,y)) {
+		return 0;
+	}
+	switch (o) {
+	default:
+	case O_UP:
+		n = y-min_y+1;
+		break;
+	case O_DOWN:
+		n = max_y-y;
+		break;
+	case O_LEFT:
+		n = x-min_x+1;
+		break;
+	case O_RIGHT:
+		n = max_x-x;
+		break;
+	}
+	for (i = 0; i < 4; i++) {
+		if (((tanks >> i) & 1) && tank[i].active) {
+			along = (tank[i].x - x)*dx + (tank[i].y - y)*dy;
+			across = abs((tank[i].x - x)*dy - (tank[i].y - y)*dx);
+			if (across < 3 && along > -3) {
+				n = min(n,max(along-2,0));
+			}
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		if ((bases >> i) & 1) {
+			along = (base[i].x - x)*dx + (base[i].y - y)*dy;
+			across = (base[i].x - x)*dy - (base[i].y - y)*dx;
+			if (across == 0 && along >= 0) {
+				n = min(n,along);
+			}
+		}
+	}
+	return n;
+}
+
+int PlayoutState::incomingStop(const int x, const int y, const int o, const int n)
+//Steps from (x,y) heading o to the first bullet coming the other way, n if
+//there's none closer
+{
+	int i,along,across,stop = n;
+	for (i = 0; i < 4; i++) {
+		if (bullet[i].active && bullet[i].o == O_OPPOSITE(o)) {
+			along = (bullet[i].x - x)*O_LOOKUP(o,O_X) + (bullet[i].y - y)*O_LOOKUP(o,O_Y);
+			across = (bullet[i].x - x)*O_LOOKUP(o,O_Y) - (bullet[i].y - y)*O_LOOKUP(o,O_X);
+			if (across == 0 && along >= 0 && along < stop) {
+				stop = along;
+			}
+		}
 	}
-	return incoming;
+	return stop;
+}
+
+int PlayoutState::fireCost(const int tank_id, const int besto, costmatrix_t& costmatrix)
+//bestC's score for C_FIRE: shooting down a bullet before it clears the first
+//wall, hitting a target through the walls or clearing the way to besto
+{
+	int x,y,stop,reach,hitcost;
+	int player = tank_id/2;
+	TankState& t = tank[tank_id];
+	x = t.x + FIRE_LOOKUP(t.o,O_X);
+	y = t.y + FIRE_LOOKUP(t.o,O_Y);
+	//Anything onTarget or onFriendly stops the shot
+	stop = rayStop(x,y,t.o,(3 << ((1-player)*2)) | (3 << player),3);
+	//Bullets coming in before the first wall get shot down
+	reach = min(stop,wallDistance(x,y,t.o)+1);
+	if (incomingStop(x,y,t.o,reach) < reach) {
+		return 0;
+	}
+	hitcost = INT_MAX-1;
+	if (onTarget(player,x + stop*O_LOOKUP(t.o,O_X),y + stop*O_LOOKUP(t.o,O_Y))) {
+		//HIT!
+		hitcost = (stop/2)+wallCost(x,y,t.o,stop);
+	}
+	if ((t.o == besto-C_UP) && isTankInsideBounds(t.x + O_LOOKUP(t.o,O_X),t.y + O_LOOKUP(t.o,O_Y)) && clearablePath(t.x,t.y,t.o) ) {
+		//Shoot to clear a space to move in
+		return min(hitcost,costmatrix(t.x + O_LOOKUP(t.o,O_X),t.y + O_LOOKUP(t.o,O_Y),t.o));
+	}
+	//Just shoot
+	return hitcost;
 }
 
 int PlayoutState::bestC(int tank_id, costmatrix_t& costmatrix, scored_cmds_t& cmds)
 {
 	scored_cmd_t cmd;
-	int i;
-	int wallcount;
-	int hitcost;
-	int x,y;
 	int player = tank_id/2;
 	TankState& t = tank[tank_id];
 	TankState& comrade = tank[tank_id^1];
@@ -1064,13 +2233,13 @@ int PlayoutState::bestC(int tank_id, costmatrix_t& costmatrix, scored_cmds_t& cm
 
 	int besto = bestOCMD(t.x,t.y,costmatrix,cmds);
 	cmd.first = C_NONE;
-	cmd.second = costmatrix[t.x][t.y][t.o]+1;
+	cmd.second = costmatrix(t.x,t.y,t.o)+1;
 	//One tank goes limp
 	if (enemy_tanks == 0 && friendly_tanks == 2) {
 		int tank_cost = abs(t.x-enemybase.x)+abs(t.y-enemybase.y);
 		int comrade_cost = abs(comrade.x-enemybase.x)+abs(comrade.y-enemybase.y);
 		if ((tank_cost > comrade_cost) || (tank_cost == comrade_cost && (tank_id & 1) == 1)) {
-			cmd.second = costmatrix[t.x][t.y][t.o]-2;
+			cmd.second = costmatrix(t.x,t.y,t.o)-2;
 		}
 	}
 	cmds.push_back(cmd);
@@ -1079,62 +2248,121 @@ int PlayoutState::bestC(int tank_id, costmatrix_t& costmatrix, scored_cmds_t& cm
 	if (!t.canfire) {
 		cmd.second = INT_MAX;
 	} else {
-		x = t.x + FIRE_LOOKUP(t.o,O_X);
-		y = t.y + FIRE_LOOKUP(t.o,O_Y);
-		wallcount = 0;
-		i = 0;
-		cmd.second = INT_MAX-1;
-		while (insideBounds(x,y) && !onTarget(player,x,y) && !onFriendly(player,x,y)) {
-			//TODO: switch to map lookup?
-			if (wallcount == 0 && (board[x][y] & B_OPPOSITE(t.o))) {
-				cmd.second = 0;
+		cmd.second = fireCost(tank_id,besto,costmatrix);
+	}
+	cmds.push_back(cmd);
+	return cmds.best();
+}
+
+int PlayoutState::legalCommands(const int tank_id)
+//Bit c is set for each command c that would do something: C_FIRE only without
+//a bullet in flight, and no driving into what's in front of the tank. C_NONE
+//is always there, and it's all an inactive tank gets.
+{
+	int j,x,y;
+	int legal = (1 << C_NONE);
+	TankState& t = tank[tank_id];
+	if (!t.active) {
+		return legal;
+	}
+	legal |= (1 << C_UP)|(1 << C_DOWN)|(1 << C_LEFT)|(1 << C_RIGHT);
+	if (!bullet[tank_id].active) {
+		legal |= (1 << C_FIRE);
+	}
+	//Turning towards a wall still turns, driving off the board still kills it
+	if (isTankInsideBounds(t.x + O_LOOKUP(t.o,O_X),t.y + O_LOOKUP(t.o,O_Y))) {
+		for (j = 0; j < 5; j++) {
+			x = t.x + BUMP_LOOKUP(t.o,j,O_X);
+			y = t.y + BUMP_LOOKUP(t.o,j,O_Y);
+			if (!B_ISCLEAR(board[x][y])) {
+				legal &= ~(1 << (C_UP+t.o));
 				break;
 			}
-			wallcount += (board[x][y] & B_WALL)*((i/2) + 1);
-			i++;
-			x += O_LOOKUP(t.o,O_X);
-			y += O_LOOKUP(t.o,O_Y);
 		}
-		if (cmd.second) {
-			hitcost = INT_MAX-1;
-			if (onTarget(player,x,y)) {
-				//HIT!
-				hitcost = ((i/2)+wallcount);
+	}
+	return legal;
+}
+
+int PlayoutState::randomC(const int tank_id, sfmt_t* sfmt)
+//Uniform pick from legalCommands. An active tank has at least 4 of the 6, so
+//drawing until one sticks takes 1.5 tries at worst.
+{
+	int c;
+	int legal = legalCommands(tank_id);
+	if (legal == (1 << C_NONE)) {
+		return C_NONE;
+	}
+	do {
+		c = randomBelow(sfmt,6);
+	} while (!((legal >> c) & 1));
+	return c;
+}
+
+int PlayoutState::greedyC(int tank_id, UtilityScores& utility)
+//Table lookup version of bestC. The table only knows about walls, so bullets and
+//tanks in the line of fire are checked here.
+{
+	int i,x,y,dx,dy,along,across,range,target;
+	int player = tank_id/2;
+	TankState& t = tank[tank_id];
+	unsigned char g = utility.greedycmd[player][PATH_STATE(path_shift,t.x,t.y,t.o)];
+
+	if (tank[(1-player)*2].active+tank[(1-player)*2+1].active == 0 && tank[tank_id^1].active) {
+		//One tank goes limp: rare enough to hand back to bestC
+		scored_cmds_t cmds;
+		return bestC(tank_id,utility.simplecost[player],cmds);
+	}
+	if (!t.canfire) {
+		return G_CANTFIRE(g);
+	}
+
+	dx = O_LOOKUP(t.o,O_X);
+	dy = O_LOOKUP(t.o,O_Y);
+	x = t.x + FIRE_LOOKUP(t.o,O_X);
+	y = t.y + FIRE_LOOKUP(t.o,O_Y);
+	range = insideBounds(x,y) ? utility.firerange[PATH_STATE(path_shift,x,y,t.o)] : 0;
+	//The closest tank in the line of fire stops the bullet
+	target = -1;
+	for (i = 0; i < 4; i++) {
+		if (i != tank_id && tank[i].active) {
+			along = (tank[i].x - x)*dx + (tank[i].y - y)*dy;
+			across = abs((tank[i].x - x)*dy - (tank[i].y - y)*dx);
+			if (across < 3 && along > -3 && max(along-2,0) < range) {
+				range = max(along-2,0);
+				target = i;
 			}
-			if ((t.o == besto-C_UP) && isTankInsideBounds(t.x + O_LOOKUP(t.o,O_X),t.y + O_LOOKUP(t.o,O_Y)) && clearablePath(t.x,t.y,t.o) ) {
-				//Shoot to clear a space to move in
-				cmd.second = min(hitcost,costmatrix[t.x + O_LOOKUP(t.o,O_X)][t.y + O_LOOKUP(t.o,O_Y)][t.o]);
-			} else {
-				//Just shoot
-				cmd.second = hitcost;
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		if (bullet[i].active && bullet[i].o == O_OPPOSITE(t.o)) {
+			along = (bullet[i].x - x)*dx + (bullet[i].y - y)*dy;
+			across = (bullet[i].x - x)*dy - (bullet[i].y - y)*dx;
+			if (across == 0 && along >= 0 && along < range) {
+				//Shoot down incoming bullets
+				return C_FIRE;
 			}
 		}
 	}
-	cmds.push_back(cmd);
-	sort(cmds.begin(), cmds.end(), sort_pair_second<int, int>());
-	return cmds[0].first;
+	if (target >= 0 && target/2 == player) {
+		//The table's shot would go into our own tank
+		return G_CANTFIRE(g);
+	}
+	if (target >= 0 && (range/2) < utility.simplecost[player](t.x,t.y,t.o)-1) {
+		//HIT!
+		return C_FIRE;
+	}
+	return G_CANFIRE(g);
 }
 
-bool PlayoutState::isTankInFiringLine(const int t, board_t& obstacles)
+bool PlayoutState::isTankInFiringLine(const int t, footprint_t& footprint)
 {
-	bool hit = false;
-	int i,j;
-	for (i = tank[t].x-2; !hit && i < tank[t].x+3;i++) {
-		for (j = tank[t].y-2; !hit && j < tank[t].y+3;j++) {
-			hit = (obstacles[i][j] & B_OOB) != 0;
-		}
-	}
-	return hit;
+	return (footprint[tank[t].x][tank[t].y] & F_EXPOSED) != 0;
 }
 
-int PlayoutState::bestCExpensive(int tank_id, costmatrix_t& costmatrix, board_t& obstacles, scored_cmds_t& cmds)
+int PlayoutState::bestCExpensive(int tank_id, costmatrix_t& costmatrix, board_t& obstacles, footprint_t& footprint, scored_cmds_t& cmds)
 {
 	scored_cmd_t cmd;
 	bool dodge;
-	int i;
-	int wallcount;
-	int hitcost;
-	int x,y;
 	int player = tank_id/2;
 	TankState& t = tank[tank_id];
 	TankState& comrade = tank[tank_id^1];
@@ -1144,7 +2372,7 @@ int PlayoutState::bestCExpensive(int tank_id, costmatrix_t& costmatrix, board_t&
 	int enemy_tanks = tank[(1-playerid)*2].active+tank[(1-playerid)*2+1].active;
 	int besto;
 	dodge = false;
-	if (isTankInFiringLine(tank_id,obstacles)) {
+	if (isTankInFiringLine(tank_id,footprint)) {
 #if DEBUGOBSTACLES
 		cout << "Tank [" << tank_id << "] needs to dodge! Using the following obstacles:" << endl;
 		paintObstacles(obstacles);
@@ -1161,13 +2389,13 @@ int PlayoutState::bestCExpensive(int tank_id, costmatrix_t& costmatrix, board_t&
 	} else {
 		besto = bestOCMD(t.x,t.y,costmatrix,obstacles,cmds);
 		cmd.first = C_NONE;
-		cmd.second = costmatrix[t.x][t.y][t.o]+1;
+		cmd.second = costmatrix(t.x,t.y,t.o)+1;
 		//One tank goes limp
 		if (enemy_tanks == 0 && friendly_tanks == 2) {
 			int tank_cost = abs(t.x-enemybase.x)+abs(t.y-enemybase.y);
 			int comrade_cost = abs(comrade.x-enemybase.x)+abs(comrade.y-enemybase.y);
 			if ((tank_cost > comrade_cost) || (tank_cost == comrade_cost && (tank_id & 1) == 1)) {
-				cmd.second = costmatrix[t.x][t.y][t.o]-2;
+				cmd.second = costmatrix(t.x,t.y,t.o)-2;
 			}
 		}
 		cmds.push_back(cmd);
@@ -1179,36 +2407,7 @@ int PlayoutState::bestCExpensive(int tank_id, costmatrix_t& costmatrix, board_t&
 		cmd.second = INT_MAX;
 	} else {
 		if (!dodge) {
-			x = t.x + FIRE_LOOKUP(t.o,O_X);
-			y = t.y + FIRE_LOOKUP(t.o,O_Y);
-			wallcount = 0;
-			i = 0;
-			cmd.second = INT_MAX-1;
-			while (insideBounds(x,y) && !onTarget(player,x,y) && !onFriendly(player,x,y)) {
-				//TODO: switch to map lookup?
-				if (wallcount == 0 && (board[x][y] & B_OPPOSITE(t.o))) {
-					cmd.second = 0;
-					break;
-				}
-				wallcount += (board[x][y] & B_WALL)*((i/2) + 1);
-				i++;
-				x += O_LOOKUP(t.o,O_X);
-				y += O_LOOKUP(t.o,O_Y);
-			}
-			if (cmd.second) {
-				hitcost = INT_MAX-1;
-				if (onTarget(player,x,y)) {
-					//HIT!
-					hitcost = ((i/2)+wallcount);
-				}
-				if ((t.o == besto-C_UP) && isTankInsideBounds(t.x + O_LOOKUP(t.o,O_X),t.y + O_LOOKUP(t.o,O_Y)) && clearablePath(t.x,t.y,t.o) ) {
-					//Shoot to clear a space to move in
-					cmd.second = min(hitcost,costmatrix[t.x + O_LOOKUP(t.o,O_X)][t.y + O_LOOKUP(t.o,O_Y)][t.o]);
-				} else {
-					//Just shoot
-					cmd.second = hitcost;
-				}
-			}
+			cmd.second = fireCost(tank_id,besto,costmatrix);
 		} else {
 			if ((t.o == besto-C_UP) && isTankInsideBounds(t.x + O_LOOKUP(t.o,O_X),t.y + O_LOOKUP(t.o,O_Y)) && clearablePath(t.x,t.y,t.o) ) {
 				cmd.second = 0; //Need to clear a space for dodging
@@ -1218,8 +2417,7 @@ int PlayoutState::bestCExpensive(int tank_id, costmatrix_t& costmatrix, board_t&
 		}
 	}
 	cmds.push_back(cmd);
-	sort(cmds.begin(), cmds.end(), sort_pair_second<int, int>());
-	return cmds[0].first;
+	return cmds.best();
 }
 
 int PlayoutState::bestOCMD(int x, int y, costmatrix_t& costmatrix, scored_cmds_t& cmds)
@@ -1229,14 +2427,13 @@ int PlayoutState::bestOCMD(int x, int y, costmatrix_t& costmatrix, scored_cmds_t
 	for (o = 0; o < 4; o++) {
 		o_score.first = o+C_UP;
 		if (clearPath(x,y,o)) {
-			o_score.second = costmatrix[x + O_LOOKUP(o,O_X)][y + O_LOOKUP(o,O_Y)][o];
+			o_score.second = costmatrix(x + O_LOOKUP(o,O_X),y + O_LOOKUP(o,O_Y),o);
 		} else {
-			o_score.second = costmatrix[x][y][o];
+			o_score.second = costmatrix(x,y,o);
 		}
 		cmds.push_back(o_score);
 	}
-	sort(cmds.begin(), cmds.end(), sort_pair_second<int, int>());
-	return cmds[0].first;
+	return cmds.best();
 }
 
 int PlayoutState::bestOCMD(int x, int y, costmatrix_t& costmatrix, board_t& obstacles, scored_cmds_t& cmds)
@@ -1248,20 +2445,22 @@ int PlayoutState::bestOCMD(int x, int y, costmatrix_t& costmatrix, board_t& obst
 		if (clearPath(x,y,o,obstacles)) {
 			//No nasty OOB stuff.
 			if (clearPath(x,y,o)) {
-				o_score.second = costmatrix[x + O_LOOKUP(o,O_X)][y + O_LOOKUP(o,O_Y)][o];
+				o_score.second = costmatrix(x + O_LOOKUP(o,O_X),y + O_LOOKUP(o,O_Y),o);
 			} else {
-				o_score.second = costmatrix[x][y][o];
+				o_score.second = costmatrix(x,y,o);
 			}
 		} else {
 			o_score.second = INT_MAX;
 		}
 		cmds.push_back(o_score);
 	}
-	sort(cmds.begin(), cmds.end(), sort_pair_second<int, int>());
-	return cmds[0].first;
+	return cmds.best();
 }
 
 int PlayoutState::bestOCMDDodgeCanfire(int t, board_t& obstacles, scored_cmds_t& cmds)
+//Still scans the 5x5 window: AVOIDANCE_CANFIRE_MATRIX weighs every cell on its own,
+//and the footprint only knows whether there's any B_OOB under the tank at all.
+//Only exposed tanks get here, so it's off the path fills' hot loop anyway.
 {
 	scored_cmd_t o_score;
 	int o,i,j,x,y,ai,aj,bx,by,range;
@@ -1281,30 +2480,24 @@ int PlayoutState::bestOCMDDodgeCanfire(int t, board_t& obstacles, scored_cmds_t&
 			}
 		}
 		if (o_score.second == 0) {
-			range = 0;
 			//It's either the wrong way or the right way!
 			bx = tank[t].x + 3*O_LOOKUP(o,O_X);
 			by = tank[t].y + 3*O_LOOKUP(o,O_X);
-			while(insideBounds(bx,by)) {
-				if ((board[bx][by] & B_OPPOSITE(o)) || onTarget(t/2,bx,by)) {
-					break;
-				}
-				range++;
-				bx += O_LOOKUP(o,O_X);
-				by += O_LOOKUP(o,O_Y);
-			}
-			if (!insideBounds(bx,by)) {
+			//Off the board before a target or an incoming bullet gets in the way
+			range = rayStop(bx,by,o,3 << ((1-t/2)*2),1 << (1-t/2));
+			range = incomingStop(bx,by,o,range);
+			if (!insideBounds(bx + range*O_LOOKUP(o,O_X),by + range*O_LOOKUP(o,O_Y))) {
 				o_score.second = range;
 			}
 		}
 
 		cmds.push_back(o_score);
 	}
-	sort(cmds.begin(), cmds.end(), sort_pair_second<int, int>());
-	return cmds[0].first;
+	return cmds.best();
 }
 
 int PlayoutState::bestOCMDDodgeCantfire(int t, board_t& obstacles, scored_cmds_t& cmds)
+//Same window scan as bestOCMDDodgeCanfire, weighted by AVOIDANCE_CANTFIRE_MATRIX
 {
 	scored_cmd_t o_score;
 	int o,i,j,x,y,ai,aj;
@@ -1327,8 +2520,7 @@ int PlayoutState::bestOCMDDodgeCantfire(int t, board_t& obstacles, scored_cmds_t
 		}
 		cmds.push_back(o_score);
 	}
-	sort(cmds.begin(), cmds.end(), sort_pair_second<int, int>());
-	return cmds[0].first;
+	return cmds.best();
 }
 
 int PlayoutState::bestO(int x, int y, costmatrix_t& costmatrix)
@@ -1338,7 +2530,7 @@ int PlayoutState::bestO(int x, int y, costmatrix_t& costmatrix)
 	int score;
 	int o;
 	for (o = 0; o < 4; o++) {
-		score = costmatrix[x + O_LOOKUP(o,O_X)][y + O_LOOKUP(o,O_Y)][o];
+		score = costmatrix(x + O_LOOKUP(o,O_X),y + O_LOOKUP(o,O_Y),o);
 		if (score < bestscore) {
 			bestscore = score;
 			besto = o;
@@ -1350,13 +2542,14 @@ int PlayoutState::bestO(int x, int y, costmatrix_t& costmatrix)
 void PlayoutState::paintUtilityScores(UtilityScores& utility)
 {
 	int o,x,y,besto,bestscore,score,bestcount;
-	unsigned char direction[MAX_BATTLEFIELD_DIM][MAX_BATTLEFIELD_DIM];
-	int count[MAX_BATTLEFIELD_DIM][MAX_BATTLEFIELD_DIM];
+	Grid<unsigned char> direction;
+	Grid<int> count;
 	Tank t;
 	paint();
 
-	memset(direction,0xff,sizeof(direction));
-	memset(count,0,sizeof(count));
+	direction.resize(board.width,board.height);
+	direction.fill(0xff);
+	count.resize(board.width,board.height);
 
 	for (y = 0; y < max_y; y++) {
 		for (x = 0; x < max_x; x++) {
@@ -1367,7 +2560,7 @@ void PlayoutState::paintUtilityScores(UtilityScores& utility)
 				for (o = 0; o < 4; o++) {
 					t.x = x + O_LOOKUP(o,O_X);
 					t.y = y + O_LOOKUP(o,O_Y);
-					score = utility.simplecost[0][t.x][t.y][o];
+					score = utility.simplecost[0](t.x,t.y,o);
 					if (score == bestscore) {
 						bestcount++;
 					}
@@ -1416,16 +2609,16 @@ void PlayoutState::paintUtilityScores(UtilityScores& utility)
 		int maxcost = 0;
 		for (i = min_x; i < max_x; i++) {
 			for (j = min_y; j < max_y; j++) {
-				if (u.expensivecost[0][i][j][o] != INT_MAX) {
-					maxcost = max(maxcost,u.simplecost[0][i][j][o]);
+				if (u.expensivecost[0](i,j,o) != INT_MAX) {
+					maxcost = max(maxcost,u.simplecost[0](i,j,o));
 				}
 			}
 		}
 		cout << maxcost << endl;
 		for (j = min_y; j < max_y; j++) {
 			for (i = min_x; i < max_x; i++) {
-				if (u.expensivecost[0][i][j][o] != INT_MAX) {
-					cout << ((u.simplecost[0][i][j][o] - 1)*10/maxcost);
+				if (u.expensivecost[0](i,j,o) != INT_MAX) {
+					cout << ((u.simplecost[0](i,j,o) - 1)*10/maxcost);
 				} else {
 					cout << "*";
 				}
@@ -1438,8 +2631,9 @@ void PlayoutState::paintUtilityScores(UtilityScores& utility)
 
 void PlayoutState::paint()
 {
-	unsigned char canvas[MAX_BATTLEFIELD_DIM][MAX_BATTLEFIELD_DIM];
+	Grid<unsigned char> canvas;
 	int i,j;
+	canvas.resize(board.width,board.height);
 	cout << "-=-=- tick: " << tickno << endl;
 	cout << "base[0] x:" << setw(3) << base[0].x << " y:" << setw(3) << base[0].y << endl;
 	for (i = 0; i < 4; i++) {
@@ -1552,14 +2746,14 @@ istream &operator>>(istream &input, PlayoutState &p)
 		input >> p.base[i].x
 		>> p.base[i].y;
 	}
-	p.min_x = 0;
-	p.min_y = 0;
 	input >> p.max_x >> p.max_y;
+	p.resize(p.max_x,p.max_y);
 	for (i = 0; i < p.max_x; i++) {
 		for (j = 0; j < p.max_y; j++) {
 			input >> square;
 			p.board[i][j] = (unsigned char)square;
 		}
 	}
+	p.drawWalls();
 	return input;
 }
@@ -13,11 +13,24 @@
 #define PLAYOUTSTATE_H_
 
 #include <iostream>
+#include <vector>
 #include "consts.h"
 #include <SFMT.h>
-#include <queue>
+#include <limits.h>
 using namespace std;
 
+//Draws from an SFMT stream without a division: randomBelow is uniform over
+//[0,n), randomChance is true with probability threshold/2^32.
+#define RANDOM_CHANCE(num,den) ((uint32_t)(((uint64_t)(num) << 32)/(den)))
+
+inline uint32_t randomBelow(sfmt_t* sfmt, const uint32_t n) {
+	return (uint32_t)(((uint64_t)sfmt_genrand_uint32(sfmt)*n) >> 32);
+}
+
+inline bool randomChance(sfmt_t* sfmt, const uint32_t threshold) {
+	return sfmt_genrand_uint32(sfmt) < threshold;
+}
+
 struct TankState {
 	int id;
 	int active;
@@ -40,35 +53,661 @@ struct BaseState {
 	int x,y;
 };
 
-typedef int costmatrix_t[MAX_BATTLEFIELD_DIM][MAX_BATTLEFIELD_DIM][4];
+/*
+ * A width by height grid, indexed grid[x][y] like a plain 2D array. Sized to
+ * the map it's used for. Copies are deep, but only allocate when the size
+ * changes, so copying a state over another one of the same map doesn't.
+ * There's always at least one cell, so grid[x] never takes &cell[0] of an
+ * empty vector, even at 0x0.
+ */
+template <class T> class Grid {
+public:
+	vector<T> cell;
+	int width;
+	int height; //Also the stride from one x to the next
+	Grid();
+	// resize to width by height, all 0
+	void resize(const int w, const int h);
+	// set every cell to value
+	void fill(const T value);
+	size_t bytes() const;
+	T* operator[](const int x);
+	const T* operator[](const int x) const;
+};
+
+template <class T> inline Grid<T>::Grid() {
+	width = 0;
+	height = 0;
+	cell.assign(1,T());
+}
+
+template <class T> inline void Grid<T>::resize(const int w, const int h) {
+	width = w;
+	height = h;
+	cell.assign(max((size_t)w*h,(size_t)1),T());
+}
+
+template <class T> inline void Grid<T>::fill(const T value) {
+	std::fill(cell.begin(),cell.end(),value);
+}
+
+template <class T> inline size_t Grid<T>::bytes() const {
+	return cell.size()*sizeof(T);
+}
+
+template <class T> inline T* Grid<T>::operator[](const int x) {
+	return &cell[0]+x*height;
+}
+
+template <class T> inline const T* Grid<T>::operator[](const int x) const {
+	return &cell[0]+x*height;
+}
+
+typedef Grid<unsigned char> board_t;
+typedef board_t obstacles_t[4];
+
+struct Tank {
+	int x,y,o,cost;
+};
+
+//(x,y,o) states come in tiles of 4x4 cells: 64 states, tile by tile.
+//Moving or turning mostly stays inside the tile, and only the tiles covering
+//the map ever get touched. A column of tiles is padded to 1 << shift of them
+//(see pathShift), so finding a state's tile is all shifts and masks.
+#define PATH_STATE(shift,x,y,o) ((((((x)>>2)<<(shift))+((y)>>2))<<6)|(((x)&3)<<4)|(((y)&3)<<2)|(o))
+#define PATH_X(shift,s) ((((s)>>((shift)+6))<<2)|(((s)>>4)&3))
+#define PATH_Y(shift,s) (((((s)>>6)&((1<<(shift))-1))<<2)|(((s)>>2)&3))
+#define PATH_O(s) ((s)&3)
+#define PATH_MAXEDGE 3 //Turn+Fire+Move
+#define PATH_BUCKETS (PATH_MAXEDGE+1)
+#define PATH_MAXREPAIR 16384 //Repairs touching more states than this refill instead
+#define PATH_MAXSEEDS(width,height) (8*max(width,height)+PATH_MAXREPAIR)
+//Cells whose change affects pathing: anything canMove, canRotate or clearablePath looks at
+#define PATH_BLOCKS (B_WALL|B_BASE|B_TANK|B_OOB)
+#define PATH_REACH 3 //Those only look this far from the tank's center
+#define PATH_NIL (-1)
+
+// PATH_STATE's shift for a map height cells high
+inline int pathShift(const int height) {
+	int shift = 0;
+	while ((1 << shift) < ((height+3) >> 2)) {
+		shift++;
+	}
+	return shift;
+}
+
+// (x,y,o) states PATH_STATE lays out for a width by height map
+inline int pathStates(const int width, const int height) {
+	return ((width+3) >> 2) << (pathShift(height)+6);
+}
+
+//Footprint of a 5x5 tank centered on a cell: what canMove, clearablePath and
+//canRotate say for each o, and whether there's B_OOB under it, all in one lookup.
+//Only centers where isTankInsideBounds holds get anything but 0.
+#define F_MOVE(o) (1 << (o))
+#define F_CLEARABLE(o) (16 << (o))
+#define F_ROTATE(o) (256 << (o))
+#define F_EXPOSED 4096
+typedef Grid<uint16_t> footprint_t;
+
+#define COST_UNREACHABLE 0xffff //Reads back as INT_MAX
+#define COST_SATURATED 0xfffe //Anything dearer is stored as this
+
+/*
+ * Cost of every (x,y,o) state, laid out by PATH_STATE and kept to 16 bits so
+ * all six matrices fit in L2 at once. Reads give INT_MAX for unreachable states,
+ * just like the plain int matrices used to.
+ */
+class CostMatrix {
+public:
+	vector<uint16_t> cost;
+	int shift; //see PATH_STATE
+	CostMatrix();
+	// resize for a width by height map, all unreachable
+	void resize(const int width, const int height);
+	int operator()(const int x, const int y, const int o) const;
+	int operator()(const int s) const;
+	void set(const int x, const int y, const int o, const int c);
+	void set(const int s, const int c);
+};
+
+inline CostMatrix::CostMatrix() {
+	shift = 0;
+}
+
+inline void CostMatrix::resize(const int width, const int height) {
+	shift = pathShift(height);
+	cost.assign(pathStates(width,height),COST_UNREACHABLE);
+}
+
+inline int CostMatrix::operator()(const int s) const {
+	int c = cost[s];
+	return (c == COST_UNREACHABLE) ? INT_MAX : c;
+}
+
+inline int CostMatrix::operator()(const int x, const int y, const int o) const {
+	return (*this)(PATH_STATE(shift,x,y,o));
+}
+
+inline void CostMatrix::set(const int s, const int c) {
+	cost[s] = (c == INT_MAX) ? COST_UNREACHABLE : min(c,COST_SATURATED);
+}
+
+inline void CostMatrix::set(const int x, const int y, const int o, const int c) {
+	set(PATH_STATE(shift,x,y,o),c);
+}
+
+typedef CostMatrix costmatrix_t;
+//(x,y,o) commands or distances, laid out by PATH_STATE
+typedef vector<unsigned char> cmdmatrix_t;
+
+/*
+ * Monotone bucket queue (Dial's algorithm) over (x,y,o) states.
+ * The costs live in the costmatrix itself: a state is queued iff its cost is
+ * tentative, and lowering it moves the state to another bucket, so every state
+ * is popped exactly once. Edges cost at most PATH_MAXEDGE, so PATH_BUCKETS
+ * buckets cover everything in flight. Seeds can cost anything: they're kept
+ * sorted on the side and merged in when the frontier reaches their cost.
+ * A repair (see PlayoutState::repairPath) seeds the states it knocked out, so
+ * queued[] rather than the cost tells which states are in a bucket.
+ */
+class PathQueue {
+public:
+	vector<int> next;
+	vector<int> prev;
+	vector<unsigned char> queued;
+	int head[PATH_BUCKETS];
+	vector<Tank> seed;
+	int max_seeds;
+	int num_seeds;
+	int next_seed;
+	int live;
+	int cost;
+	costmatrix_t* dist;
+	//Scratch for repairPath: tank centers near a changed cell, and the footprint
+	//it's repairing from. drawFootprint borrows before for its runs.
+	board_t dirty;
+	footprint_t before;
+	PathQueue();
+	// resize for a width by height map, with nothing queued
+	void resize(const int width, const int height);
+	// queue a seed, before begin()
+	void push(const Tank& t);
+	// start a flood fill on costmatrix, which must be INT_MAX wherever it's unexplored
+	void begin(costmatrix_t& costmatrix);
+	// pop the cheapest state, false when the fill is done
+	bool pop(Tank& g);
+	// offer state (x,y,o) at cost c
+	void relax(int x, int y, int o, int c);
+private:
+	void link(int s, int c);
+	void unlink(int s, int c);
+};
+
+inline bool seed_cost_less(const Tank& a, const Tank& b)
+{
+	return a.cost < b.cost;
+}
+
+inline PathQueue::PathQueue() {
+	max_seeds = 0;
+	num_seeds = 0;
+}
+
+inline void PathQueue::resize(const int width, const int height) {
+	int states = pathStates(width,height);
+	next.assign(states,PATH_NIL);
+	prev.assign(states,PATH_NIL);
+	queued.assign(states,0);
+	max_seeds = PATH_MAXSEEDS(width,height);
+	seed.resize(max_seeds);
+	num_seeds = 0;
+	dirty.resize(width,height);
+	before.resize(width,height);
+}
+
+inline void PathQueue::push(const Tank& t) {
+	if (num_seeds < max_seeds) {
+		seed[num_seeds] = t;
+		num_seeds++;
+	}
+}
+
+inline void PathQueue::begin(costmatrix_t& costmatrix) {
+	int b;
+	dist = &costmatrix;
+	for (b = 0; b < PATH_BUCKETS; b++) {
+		head[b] = PATH_NIL;
+	}
+	sort(seed.begin(), seed.begin()+num_seeds, seed_cost_less);
+	next_seed = 0;
+	live = 0;
+	cost = (num_seeds > 0) ? seed[0].cost : 0;
+}
+
+inline void PathQueue::link(int s, int c) {
+	int b = c % PATH_BUCKETS;
+	next[s] = head[b];
+	prev[s] = PATH_NIL;
+	if (head[b] != PATH_NIL) {
+		prev[head[b]] = s;
+	}
+	head[b] = s;
+	queued[s] = 1;
+	live++;
+}
+
+inline void PathQueue::unlink(int s, int c) {
+	if (prev[s] != PATH_NIL) {
+		next[prev[s]] = next[s];
+	} else {
+		head[c % PATH_BUCKETS] = next[s];
+	}
+	if (next[s] != PATH_NIL) {
+		prev[next[s]] = prev[s];
+	}
+	queued[s] = 0;
+	live--;
+}
+
+inline void PathQueue::relax(int x, int y, int o, int c) {
+	int s = PATH_STATE(dist->shift,x,y,o);
+	c = min(c,COST_SATURATED);
+	if (c < dist->cost[s]) {
+		if (queued[s]) {
+			unlink(s,dist->cost[s]);
+		}
+		dist->cost[s] = c;
+		link(s,c);
+	}
+}
+
+inline bool PathQueue::pop(Tank& g) {
+	int s;
+	for (;;) {
+		while (next_seed < num_seeds && seed[next_seed].cost <= cost) {
+			relax(seed[next_seed].x,seed[next_seed].y,seed[next_seed].o,seed[next_seed].cost);
+			next_seed++;
+		}
+		s = head[cost % PATH_BUCKETS];
+		if (s != PATH_NIL) {
+			unlink(s,cost);
+			g.x = PATH_X(dist->shift,s);
+			g.y = PATH_Y(dist->shift,s);
+			g.o = PATH_O(s);
+			g.cost = cost;
+			return true;
+		}
+		if (live > 0) {
+			cost++;
+		} else if (next_seed < num_seeds) {
+			cost = seed[next_seed].cost;
+		} else {
+			num_seeds = 0;
+			return false;
+		}
+	}
+}
+
+/*
+ * Cluster abstraction for filling a cost matrix only where it gets read (HPA*).
+ * The tank centers are cut into HPA_CLUSTER square clusters. Each open run along
+ * the border between two clusters gets a portal every HPA_GAP cells, and a
+ * portal is two nodes: the states a tank ends up in crossing it either way.
+ * Every cluster knows what it costs to get from the nodes arriving in it to
+ * the nodes leaving it, and to the goal, without leaving. Searching those nodes
+ * gives the cost beyond a window around the tank, and findPath fills in the
+ * window from there. See PlayoutState::fillPathHierarchy.
+ */
+#define HPA_FROM 192 //Maps at least this wide or high fill expensivecost this way
+#define HPA_CLUSTER 16
+#define HPA_GAP 8
+#define HPA_PORTALS 4 //Per border, runs past these don't get any
+#define HPA_SLOTS (2*HPA_PORTALS) //Nodes per border: portal p's are 2p (right or down) and 2p+1 (left or up)
+#define HPA_LOCAL (4*HPA_SLOTS) //Nodes per cluster, HPA_SLOTS on each side (indexed by o)
+#define HPA_WINDOW 1 //Clusters refined on each side of the tank's
+//Going round a window: turning at every step and clearing a wall every other one
+#define HPA_DETOUR(box) (4*((box).x1-(box).x0+(box).y1-(box).y0))
+
+//Cells x0 <= x < x1, y0 <= y < y1
+struct PathBox {
+	int x0,y0,x1,y1;
+	bool contains(const int x, const int y) const;
+};
+
+inline bool PathBox::contains(const int x, const int y) const {
+	return x >= x0 && x < x1 && y >= y0 && y < y1;
+}
+
+struct PathCluster {
+	//(arrival)(exit) cost between nodes on this cluster's sides, by local index,
+	//COST_UNREACHABLE if there's no way without leaving
+	uint16_t edge[HPA_LOCAL][HPA_LOCAL];
+	//(arrival) cost to the goal without leaving, all COST_UNREACHABLE if it
+	//holds no seeds
+	uint16_t goal[HPA_LOCAL];
+	bool dirty; //Its footprint or seeds changed: the portals around it need placing
+	bool linked; //edge is up to date, it's only worked out once a search gets here
+	bool scored; //goal is up to date
+};
+
+class PathHierarchy {
+public:
+	int width,height; //In clusters, cluster (cx,cy) is cx*height+cy
+	//(border*HPA_SLOTS+slot) portal nodes, x < 0 where there's none. Cluster c's
+	//border on the right is 2c, the one below it 2c+1.
+	vector<Tank> node;
+	//(node) cost to the goal, as far as the search got, and 1 once it's settled
+	vector<int> dist;
+	vector<unsigned char> closed;
+	//(node) 1 for the nodes leading out of the window being refined, which are
+	//listed in target
+	vector<unsigned char> wanted;
+	vector<int> target;
+	vector<PathCluster> cluster;
+	//The seeds it was built with, to tell which clusters' goals moved
+	vector<Tank> seed;
+	int bounds[4]; //min_x,min_y,max_x,max_y it was built on, all 0 if it wasn't
+	PathBox window; //Cells the last fill refined
+	vector< pair<int,int> > heap;
+	PathHierarchy();
+	// resize for a width by height map, with nothing built
+	void resize(const int width, const int height);
+	// node behind local index l of cluster c, -1 if that side is the map's edge
+	int localNode(const int c, const int l) const;
+	// cluster a node's crossing starts from, and its local index there
+	int exitCluster(const int n, int& l) const;
+	// cluster containing cell (x,y)
+	int clusterAt(const int x, const int y) const;
+	// forget cluster c's edges and goal, its nodes moved
+	void invalidate(const int c);
+	// the cells of cluster c
+	PathBox clusterBox(const int c, const int cellwidth, const int cellheight) const;
+};
+
+inline PathHierarchy::PathHierarchy() {
+	width = 0;
+	height = 0;
+	fill(bounds, bounds+4, 0);
+	window.x0 = window.y0 = window.x1 = window.y1 = 0;
+}
+
+inline void PathHierarchy::resize(const int width, const int height) {
+	this->width = (width+HPA_CLUSTER-1)/HPA_CLUSTER;
+	this->height = (height+HPA_CLUSTER-1)/HPA_CLUSTER;
+	Tank none;
+	none.x = none.y = -1;
+	none.o = 0;
+	none.cost = 0;
+	node.assign(2*this->width*this->height*HPA_SLOTS,none);
+	dist.assign(node.size(),INT_MAX);
+	closed.assign(node.size(),0);
+	wanted.assign(node.size(),0);
+	target.clear();
+	cluster.resize(this->width*this->height);
+	seed.clear();
+	fill(bounds, bounds+4, 0);
+	window.x0 = window.y0 = window.x1 = window.y1 = 0;
+}
+
+inline int PathHierarchy::localNode(const int c, const int l) const {
+	int slot = l % HPA_SLOTS;
+	switch (l / HPA_SLOTS) {
+	default:
+	case O_UP:
+		return (c % height > 0) ? (2*(c-1)+1)*HPA_SLOTS+slot : -1;
+	case O_DOWN:
+		return (c % height < height-1) ? (2*c+1)*HPA_SLOTS+slot : -1;
+	case O_LEFT:
+		return (c >= height) ? (2*(c-height))*HPA_SLOTS+slot : -1;
+	case O_RIGHT:
+		return (c < (width-1)*height) ? (2*c)*HPA_SLOTS+slot : -1;
+	}
+}
+
+inline int PathHierarchy::exitCluster(const int n, int& l) const {
+	int border = n / HPA_SLOTS;
+	int slot = n % HPA_SLOTS;
+	int c = border/2;
+	if (border & 1) {
+		//Below c: down out of c, or up out of the one below
+		l = ((slot & 1) ? O_UP : O_DOWN)*HPA_SLOTS+slot;
+		return (slot & 1) ? c+1 : c;
+	}
+	l = ((slot & 1) ? O_LEFT : O_RIGHT)*HPA_SLOTS+slot;
+	return (slot & 1) ? c+height : c;
+}
+
+inline int PathHierarchy::clusterAt(const int x, const int y) const {
+	return (x/HPA_CLUSTER)*height+y/HPA_CLUSTER;
+}
+
+inline void PathHierarchy::invalidate(const int c) {
+	cluster[c].linked = false;
+	cluster[c].scored = false;
+	fill(cluster[c].goal,cluster[c].goal+HPA_LOCAL,(uint16_t)COST_UNREACHABLE);
+}
+
+inline PathBox PathHierarchy::clusterBox(const int c, const int cellwidth, const int cellheight) const {
+	PathBox box;
+	box.x0 = (c / height)*HPA_CLUSTER;
+	box.y0 = (c % height)*HPA_CLUSTER;
+	box.x1 = min(box.x0+HPA_CLUSTER,cellwidth);
+	box.y1 = min(box.y0+HPA_CLUSTER,cellheight);
+	return box;
+}
+
+//The independent pieces of UtilityScores, each with its own scratch space
+#define U_SIMPLE(player) (player)
+#define U_EXPENSIVE(tankid) (2+(tankid))
+#define U_JOBS 6
+#define U_MAXPATCHES 64 //Breadcrumbs for two enemies plus the base
+
 class UtilityScores {
 public:
 	//(player)(x)(y)(o)
 	costmatrix_t simplecost[2];
 	//(tankid)(x)(y)(o)
 	costmatrix_t expensivecost[4];
+	//(player)(x)(y)(o) greedy command derived from simplecost, see G_PACK
+	cmdmatrix_t greedycmd[2];
+	//(x)(y)(o) squares a bullet fired from here travels before hitting a wall, at most UCHAR_MAX
+	cmdmatrix_t firerange;
+	//Scratch space for findPath, one per job so they can run side by side
+	PathQueue frontier[U_JOBS];
+	//What each job's cost matrix was last filled against, so it can be repaired
+	board_t pathboard[U_JOBS];
+	//(job)(x)(y) pathboard's footprint, kept up to date along with the costs
+	footprint_t footprint[U_JOBS];
+	//(job)(min_x,min_y,max_x,max_y) of that fill, all 0 if there wasn't one
+	int extent[U_JOBS][4];
+	//(job) entries written over the fill afterwards, with the cost they replaced
+	Tank patch[U_JOBS][U_MAXPATCHES];
+	int num_patches[U_JOBS];
+	//Repair last tick's cost matrices instead of refilling them from scratch
+	bool incremental;
+	//(tankid) cluster abstractions expensivecost is filled from, if hierarchical
+	PathHierarchy hierarchy[4];
+	//Fill expensivecost around each tank only, see HPA_FROM
+	bool hierarchical;
+	//The map everything above is sized for
+	int width,height;
+	UtilityScores();
+	// size everything for a width by height map, if it isn't already
+	void resize(const int width, const int height);
+	// heap taken by everything above
+	size_t bytes() const;
+	// overwrite costmatrix[x][y][o] with c, remembering what was there
+	void patchCost(const int job, costmatrix_t& costmatrix, const int x, const int y, const int o, const int c);
+	// put back what patchCost overwrote
+	void unpatchCosts(const int job, costmatrix_t& costmatrix);
 };
 
-struct Tank {
-	int x,y,o,cost;
-};
+inline UtilityScores::UtilityScores() {
+	int job;
+	for (job = 0; job < U_JOBS; job++) {
+		fill(extent[job], extent[job]+4, 0);
+		num_patches[job] = 0;
+	}
+	incremental = true;
+	hierarchical = false;
+	width = 0;
+	height = 0;
+}
+
+inline void UtilityScores::resize(const int width, const int height) {
+	int i,job;
+	if (width == this->width && height == this->height) {
+		return;
+	}
+	this->width = width;
+	this->height = height;
+	for (i = 0; i < 2; i++) {
+		simplecost[i].resize(width,height);
+		greedycmd[i].assign(pathStates(width,height),0);
+	}
+	for (i = 0; i < 4; i++) {
+		expensivecost[i].resize(width,height);
+		hierarchy[i].resize(width,height);
+	}
+	hierarchical = max(width,height) >= HPA_FROM;
+	firerange.assign(pathStates(width,height),0);
+	for (job = 0; job < U_JOBS; job++) {
+		frontier[job].resize(width,height);
+		pathboard[job].resize(width,height);
+		footprint[job].resize(width,height);
+		//Nothing to repair from
+		fill(extent[job], extent[job]+4, 0);
+		num_patches[job] = 0;
+	}
+}
+
+inline size_t UtilityScores::bytes() const {
+	size_t total = 0;
+	int i,job;
+	for (i = 0; i < 2; i++) {
+		total += simplecost[i].cost.size()*sizeof(uint16_t)+greedycmd[i].size();
+	}
+	for (i = 0; i < 4; i++) {
+		total += expensivecost[i].cost.size()*sizeof(uint16_t);
+	}
+	total += firerange.size();
+	for (job = 0; job < U_JOBS; job++) {
+		total += frontier[job].next.size()*sizeof(int)*2+frontier[job].queued.size()
+				+frontier[job].seed.size()*sizeof(Tank)+frontier[job].dirty.bytes()+frontier[job].before.bytes();
+		total += pathboard[job].bytes()+footprint[job].bytes();
+	}
+	for (i = 0; i < 4; i++) {
+		total += hierarchy[i].node.size()*(sizeof(Tank)+sizeof(int)+2)+hierarchy[i].cluster.size()*sizeof(PathCluster);
+	}
+	return total;
+}
+
+inline void UtilityScores::patchCost(const int job, costmatrix_t& costmatrix, const int x, const int y, const int o, const int c) {
+	Tank t;
+	if (num_patches[job] < U_MAXPATCHES) {
+		t.x = x;
+		t.y = y;
+		t.o = o;
+		t.cost = costmatrix(x,y,o);
+		patch[job][num_patches[job]] = t;
+		num_patches[job]++;
+	} else {
+		//Can't undo this one: the next tick has to refill
+		fill(extent[job], extent[job]+4, 0);
+	}
+	costmatrix.set(x,y,o,c);
+}
+
+inline void UtilityScores::unpatchCosts(const int job, costmatrix_t& costmatrix) {
+	int i;
+	for (i = num_patches[job]-1; i >= 0; i--) {
+		costmatrix.set(patch[job][i].x,patch[job][i].y,patch[job][i].o,patch[job][i].cost);
+	}
+	num_patches[job] = 0;
+}
 
 typedef pair<int,int> scored_cmd_t;
-typedef vector<scored_cmd_t> scored_cmds_t;
 
-inline bool operator<(const Tank& a,const Tank& b)
-//The priority is HIGHER if the cost is LOWER
-{
-  return a.cost > b.cost;
+#define SCORED_CMDS_MAX 6 //A tank never has more than 6 commands to choose from
+
+//P.O.D structure: lives on the stack, never allocates
+class ScoredCmds {
+public:
+	scored_cmd_t entry[SCORED_CMDS_MAX];
+	int count;
+	ScoredCmds();
+	void clear();
+	void push_back(const scored_cmd_t& cmd);
+	// move the k lowest scores to the front, in order
+	void top(int k);
+	// lowest scoring command
+	int best();
+	int size() const;
+	scored_cmd_t& operator[](int i);
+};
+
+inline ScoredCmds::ScoredCmds() {
+	count = 0;
 }
 
-typedef unsigned char board_t[MAX_BATTLEFIELD_DIM][MAX_BATTLEFIELD_DIM];
-typedef board_t obstacles_t[4];
+inline void ScoredCmds::clear() {
+	count = 0;
+}
+
+inline void ScoredCmds::push_back(const scored_cmd_t& cmd) {
+	entry[count] = cmd;
+	count++;
+}
+
+/* Partial selection sort. The comparisons compile to conditional moves. */
+inline void ScoredCmds::top(int k) {
+	int i,j,m;
+	scored_cmd_t tmp;
+	k = min(k,count);
+	for (i = 0; i < k; i++) {
+		m = i;
+		for (j = i+1; j < count; j++) {
+			m = (entry[j].second < entry[m].second) ? j : m;
+		}
+		tmp = entry[i];
+		entry[i] = entry[m];
+		entry[m] = tmp;
+	}
+}
+
+inline int ScoredCmds::best() {
+	top(1);
+	return entry[0].first;
+}
+
+inline int ScoredCmds::size() const {
+	return count;
+}
+
+inline scored_cmd_t& ScoredCmds::operator[](int i) {
+	return entry[i];
+}
+
+typedef ScoredCmds scored_cmds_t;
+
+#define WALL_WORDS(n) (((n)+31) >> 5) //32 bit words covering n cells
+
+//Map sizes the simulator and pathfinder are compiled for, see mapSize.
+//MAP_ANY reads the size off the state instead.
+#define MAP_ANY 0
+#define MAP_81X81 1 //board1.map
 
-//POD structure
+//Copy with = rather than memcpy: the grids live on the heap, sized by resize
 class PlayoutState {
 public:
 	board_t board;
+	//The walls on board, a line at a time: wallbits[O_X][y] has bit x set for a
+	//wall at (x,y), wallbits[O_Y][x] has bit y. See drawWalls and markWall.
+	Grid<uint32_t> wallbits[2];
+	//Which tank a B_TANK square on board belongs to. Stale wherever board
+	//doesn't have B_TANK. See tankAt.
+	board_t occupant;
 	int tickno;
 	int command[4]; //commands given to the tanks (index is the same as tank[4])
 	int tank_priority[4]; //order in which tanks should be moved
@@ -77,23 +716,35 @@ public:
 	BaseState base[2]; //Base 0 belongs to PLAYER0, Base 1 belongs to PLAYER1
 	int min_x,min_y;
 	int max_x,max_y;
+	int path_shift; //PATH_STATE's shift for this map
 	bool gameover;
 	bool stop_playout;
 	double state_score;
 	double winner;
 	int endgame_tick;
+	void resize(const int width, const int height);
 	void drawTanks();
 	void drawTinyTanks();
 	void drawBases();
 	void drawBullets();
+	void drawWalls();
+	void markWall(const int x, const int y);
+	int mapSize();
+	int tankAt(const int x, const int y);
+	template <class Dim> int tankAt(const int x, const int y);
 	void moveBullets();
-	void moveTanks();
-	void fireTanks();
-	void checkCollisions();
+	template <class Dim> void moveBullets();
+	template <class Dim> void moveTanks();
+	template <class Dim> void fireTanks();
+	template <class Dim> void checkCollisions();
 	void checkDestroyedBullets();
 	void move(Move& m);
 	void simulateTick();
-	double playout(sfmt_t* sfmt, UtilityScores& utility);
+	template <class Dim> void simulateTick();
+	double playout(sfmt_t* sfmt, UtilityScores& utility, const int depth, const int policy);
+	template <class Dim> double playout(sfmt_t* sfmt, UtilityScores& utility, const int depth, const int policy);
+	template <class Policy, class Dim> double playout(sfmt_t* sfmt, UtilityScores& utility, const int depth);
+	double evaluate(UtilityScores& utility);
 	void updateCanFire();
 	bool insideBounds(const int x, const int y);
 	bool isTankInsideBounds(const int x, const int y);
@@ -111,18 +762,41 @@ public:
 	bool onBase(const int b, const int x, const int y);
 	bool onTarget(const int t, const int x, const int y);
 	bool onFriendly(const int t, const int x, const int y);
-	bool incomingBullet(const int x, const int y, const int o);
 	bool isTankAt(const int t, const int x, const int y);
-	bool isTankInFiringLine(const int t, board_t& obstacles);
+	bool isTankInFiringLine(const int t, footprint_t& footprint);
 	void drawTank(const int t, const int block);
 	void drawTankObstacle(const int t, board_t& obstacles);
 	void drawTankObstacle(const int x, const int y, board_t& obstacles);
 	void drawTinyTank(const int t, const int block);
-	void seedBase(const int player, priority_queue<Tank>& frontier, board_t& obstacles);
-	void findPath(priority_queue<Tank>& frontier, costmatrix_t& costmatrix, board_t& obstacles);
-	void updateSimpleUtilityScores(UtilityScores& utility, obstacles_t& obstacles);
+	void seedBase(const int player, PathQueue& frontier, board_t& obstacles);
+	int footprintAt(const int x, const int y, board_t& obstacles);
+	void drawFootprint(footprint_t& footprint, board_t& obstacles, footprint_t& runs);
+	template <class Dim> void drawFootprint(footprint_t& footprint, board_t& obstacles, footprint_t& runs);
+	void findPath(PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint);
+	template <class Dim, class Clip> void findPath(PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint, const Clip& clip);
+	int settledCost(const int x, const int y, const int to, costmatrix_t& costmatrix, footprint_t& footprint);
+	bool repairPath(PathQueue& frontier, costmatrix_t& costmatrix, board_t& before, board_t& after, footprint_t& footprint, const int player);
+	void fillPath(UtilityScores& utility, const int job, costmatrix_t& costmatrix, board_t& obstacles, const int player);
+	void rememberFill(UtilityScores& utility, const int job, board_t& obstacles);
+	void fillPathHierarchy(UtilityScores& utility, const int job, costmatrix_t& costmatrix, board_t& obstacles, const int player);
+	bool placePortals(PathHierarchy& hierarchy, footprint_t& footprint, const int c, const int below);
+	void linkCluster(PathHierarchy& hierarchy, PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint, const int c);
+	void scoreCluster(PathHierarchy& hierarchy, PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint, const int c);
+	void searchHierarchy(PathHierarchy& hierarchy, PathQueue& frontier, costmatrix_t& costmatrix, footprint_t& footprint, const PathBox& window);
+	void updateSimpleUtilityScores(UtilityScores& utility);
+	void updateSimpleUtilityScore(UtilityScores& utility, const int player);
+	void patchSimpleUtilityScore(UtilityScores& utility, const int player);
 	void updateExpensiveUtilityScores(UtilityScores& utility, obstacles_t& obstacles);
+	void updateExpensiveUtilityScore(UtilityScores& utility, obstacles_t& obstacles, const int tankid);
+	void drawExpensiveObstacles(UtilityScores& utility, obstacles_t& obstacles, const int tankid);
+	void patchExpensiveUtilityScore(UtilityScores& utility, const int tankid);
+	void updateGreedyCommands(UtilityScores& utility);
 	bool lineOfSight(const int sx, const int sy, const int o, const int tx, const int ty);
+	int wallDistance(const int x, const int y, const int o);
+	int wallCost(const int x, const int y, const int o, const int n);
+	int rayStop(const int x, const int y, const int o, const int tanks, const int bases);
+	int incomingStop(const int x, const int y, const int o, const int n);
+	int fireCost(const int tank_id, const int besto, costmatrix_t& costmatrix);
 	void save();
 	int bestOCMD(int x, int y, costmatrix_t& costmatrix, scored_cmds_t& cmds);
 	int bestOCMD(int x, int y, costmatrix_t& costmatrix, board_t& obstacles, scored_cmds_t& cmds);
@@ -131,7 +805,10 @@ public:
 	int bestO(int x, int y, costmatrix_t& costmatrix);
 	//int cmdToSimpleUtility(int c, int t);
 	int bestC(int tank_id, costmatrix_t& costmatrix, scored_cmds_t& cmds);
-	int bestCExpensive(int tank_id, costmatrix_t& costmatrix, board_t& obstacles, scored_cmds_t& cmds);
+	int greedyC(int tank_id, UtilityScores& utility);
+	int legalCommands(const int tank_id);
+	int randomC(const int tank_id, sfmt_t* sfmt);
+	int bestCExpensive(int tank_id, costmatrix_t& costmatrix, board_t& obstacles, footprint_t& footprint, scored_cmds_t& cmds);
 	//int cmdToExpensiveUtility(int c, int t);
 	//friend ostream &operator<<(ostream &output, const PlayoutState &p);
 	//friend istream &operator>>(istream  &input, PlayoutState &p);
@@ -19,6 +19,7 @@
 #include "CalcEquilibrium.h"
 #include "PlayoutState.h"
 #include "NetworkCore.h"
+#include "ChallengeServer.h"
 #include <tinythread.h>
 #include "MCTree.h"
 #include <time.h>
@@ -33,14 +34,73 @@ using namespace std;
 #define MODE_BENCHMARK 2
 #define MODE_SELFPLAY 3
 #define MODE_SHOWPATH 4
+#define MODE_BENCHPOLICY 5
+#define MODE_VERIFYREPAIR 6
+#define MODE_BENCHRNG 8
+#define MODE_BENCHDEPTH 9
+#define MODE_BENCHPLAYOUT 10
+#define MODE_BENCHSCALE 11
+#define MODE_VERIFYHPA 12
+#define MODE_BENCHSOAP 13
+#define MODE_BENCHDECODE 14
+#define MODE_SERVE 15
+#define MODE_REPLAY 16
+
+#define BENCHPOLICY_CALLS 200000
+#define VERIFYREPAIR_TICKS 300
+#define BENCHRNG_PLAYOUTS 2000
+#define BENCHRNG_DRAWS 30000000
+#define BENCHDEPTH_STATES 8
+#define BENCHDEPTH_PLAYOUTS 1000 //per state and move
+#define BENCHDEPTH_DEPTHS 6
+#define BENCHPLAYOUT_PLAYOUTS 4000
+#define BENCHSCALE_FILLS 4
+#define BENCHSCALE_PLAYOUTS 200
+#define VERIFYHPA_SIZE 512
+#define VERIFYHPA_TICKS 60
+#define BENCHSOAP_CALLS 500 //per setup
+#define BENCHDECODE_ROUNDS 2000
+#define SERVE_PORT 7070
+
+void tileMap(PlayoutState& map, PlayoutState& state, const int n)
+//map's walls repeated out to n by n, with its bases and tanks moved to scale
+//and some room cleared around the tanks
+{
+	int x,y,dx,dy,tankid;
+	state = map;
+	state.resize(n,n);
+	for (x = 0; x < n; x++) {
+		for (y = 0; y < n; y++) {
+			state.board[x][y] = map.board[x % map.max_x][y % map.max_y] & B_WALL;
+		}
+	}
+	for (tankid = 0; tankid < 4; tankid++) {
+		state.tank[tankid].x = map.tank[tankid].x*n/map.max_x;
+		state.tank[tankid].y = map.tank[tankid].y*n/map.max_y;
+		for (dx = -3; dx <= 3; dx++) {
+			for (dy = -3; dy <= 3; dy++) {
+				state.board[state.tank[tankid].x+dx][state.tank[tankid].y+dy] = B_EMPTY;
+			}
+		}
+	}
+	for (x = 0; x < 2; x++) {
+		state.base[x].x = map.base[x].x*n/map.max_x;
+		state.base[x].y = map.base[x].y*n/map.max_y;
+	}
+	state.drawWalls();
+	state.drawBases();
+	state.drawTanks();
+	state.drawBullets();
+}
 
 int main(int argc, char** argv) {
 	int mode = MODE_SOAP;
 	const char* soap_endpoint = "http://localhost:9090/ChallengePort";
+	const char* capture_file = NULL;
 #if DEBUG
 	cerr << "Hardware concurrency: " << tthread::thread::hardware_concurrency() << endl;
 #endif
-	if (argc == 2) {
+	if (argc >= 2) {
 		soap_endpoint = argv[1]; //Use 1st argument as default;
 		if (strcmp(argv[1],"0") == 0) {
 			soap_endpoint = "http://localhost:7070/Challenge/ChallengeService";
@@ -57,14 +117,66 @@ int main(int argc, char** argv) {
 		if (strcmp(argv[1],"showpath") == 0) {
 			mode = MODE_SHOWPATH;
 		}
+		if (strcmp(argv[1],"benchpolicy") == 0) {
+			mode = MODE_BENCHPOLICY;
+		}
+		if (strcmp(argv[1],"verifyrepair") == 0) {
+			mode = MODE_VERIFYREPAIR;
+		}
+		if (strcmp(argv[1],"benchrng") == 0) {
+			mode = MODE_BENCHRNG;
+		}
+		if (strcmp(argv[1],"benchdepth") == 0) {
+			mode = MODE_BENCHDEPTH;
+		}
+		if (strcmp(argv[1],"benchplayout") == 0) {
+			mode = MODE_BENCHPLAYOUT;
+		}
+		if (strcmp(argv[1],"benchscale") == 0) {
+			mode = MODE_BENCHSCALE;
+		}
+		if (strcmp(argv[1],"verifyhpa") == 0) {
+			mode = MODE_VERIFYHPA;
+		}
+		if (strcmp(argv[1],"benchsoap") == 0) {
+			//benchsoap [endpoint [calls]]
+			mode = MODE_BENCHSOAP;
+			soap_endpoint = (argc > 2) ? argv[2] : "http://localhost:9090/ChallengePort";
+		}
+		if (strcmp(argv[1],"benchdecode") == 0) {
+			//benchdecode [status.xml [login.xml]], canned responses otherwise
+			mode = MODE_BENCHDECODE;
+		}
+		if (strcmp(argv[1],"serve") == 0) {
+			//serve [port [tick_ms [delay_ms [jitter_ms [ticks]]]]]
+			mode = MODE_SERVE;
+		}
+		if (strcmp(argv[1],"record") == 0 && argc > 3) {
+			//record endpoint capture: plays as usual and records the traffic
+			soap_endpoint = argv[2];
+			capture_file = argv[3];
+		}
+		if (strcmp(argv[1],"replay") == 0 && argc > 2) {
+			//replay capture [speed], 0 to go as fast as the search decides
+			mode = MODE_REPLAY;
+			capture_file = argv[2];
+		}
 	}
 	if (mode == MODE_SOAP) {
 		cout << "Network Play using SOAP: [" << soap_endpoint << "]" << endl;
 		NetworkCore* netcore = new NetworkCore(soap_endpoint);
 		netcore->policy = POLICY_MCTS;
+		if (capture_file && netcore->record(capture_file)) {
+			cout << "Recording to " << capture_file << endl;
+		}
 		netcore->login();
 		netcore->play();
 		delete netcore;
+	} else if (mode == MODE_REPLAY) {
+		NetworkCore* netcore = new NetworkCore(soap_endpoint);
+		netcore->policy = POLICY_MCTS;
+		netcore->replay(capture_file, (argc > 3) ? atof(argv[3]) : 1.0);
+		delete netcore;
 	} else if (mode == MODE_BENCHMARK) {
 		MCTree *mc_tree = new MCTree;
 		PlayoutState* node_state = new PlayoutState;
@@ -103,12 +215,18 @@ int main(int argc, char** argv) {
 		cout << "Populating utility scores..." << endl;
 		utility_timer.restart();
 		node_state->updateCanFire();
-		node_state->updateSimpleUtilityScores(*u,obstacles);
+		node_state->updateSimpleUtilityScores(*u);
+		node_state->updateGreedyCommands(*u);
 		node_state->updateExpensiveUtilityScores(*u,obstacles);
 		utility_timer.stop();
 		utility_stat.push((double)utility_timer.get_milliseconds());
 		cout << "Utility scores populated! [" << utility_timer.get_milliseconds() << " ms]"<<endl;
 		delete u;
+		*mc_tree->root_state = *node_state;
+		utility_timer.restart();
+		mc_tree->populate_utility();
+		utility_timer.stop();
+		cout << "Utility scores populated by " << mc_tree->num_workers << " workers! [" << utility_timer.get_milliseconds() << " ms]" << endl;
 #endif
 		mc_tree->init(node_state);
 		//cout << mc_tree->root_state;
@@ -130,7 +248,7 @@ int main(int argc, char** argv) {
 			//cout << "width: " << width << endl;
 			path.clear();
 			results.clear();
-			memcpy(node_state,mc_tree->root_state,sizeof(PlayoutState));
+			*node_state = *mc_tree->root_state;
 			node_id = mc_tree->root_id;
 #if BENCHMARK
 			select_timer.restart();
@@ -202,8 +320,8 @@ int main(int argc, char** argv) {
 		mc_tree->init(node_state);
 		mc_tree->root_state->paintUtilityScores(*mc_tree->root_u);
 		for (i = 0; i < 50000; i++) {
-			memcpy(tmp_state,mc_tree->root_state,sizeof(PlayoutState));
-			double result = tmp_state->playout(mc_tree->worker_sfmt[0],*mc_tree->root_u);
+			*tmp_state = *mc_tree->root_state;
+			double result = tmp_state->playout(mc_tree->worker_sfmt[0],*mc_tree->root_u,mc_tree->playout_depth,mc_tree->policy_at(0));
 			playouts.push(result);
 			//cout << result << endl;
 		}
@@ -225,11 +343,498 @@ int main(int argc, char** argv) {
 		playouts.init();
 		mc_tree->init(node_state);
 		mc_tree->root_state->paintUtilityScores(*mc_tree->root_u);
-		double result = mc_tree->root_state->playout(mc_tree->worker_sfmt[0],*mc_tree->root_u);
+		double result = mc_tree->root_state->playout(mc_tree->worker_sfmt[0],*mc_tree->root_u,mc_tree->playout_depth,mc_tree->policy_at(0));
 		playouts.push(result);
 		//cout << result << endl;
 		delete node_state;
 		delete mc_tree;
+	} else if (mode == MODE_BENCHPOLICY) {
+		MCTree* mc_tree = new MCTree;
+		PlayoutState* node_state = new PlayoutState;
+		platformstl::performance_counter policy_timer;
+		scored_cmds_t cmds;
+		int i,tankid,policyid;
+		long int sink = 0;
+		const char* policy_name[] = {"bestC","greedyC","bestCExpensive","bestOCMD","bestOCMD (obstacles)",
+				"bestOCMDDodgeCanfire","bestOCMDDodgeCantfire"};
+		ifstream fin("board1.map");
+		fin >> *node_state;
+		node_state->endgame_tick = 200;
+		node_state->gameover = false;
+		node_state->stop_playout = false;
+		fin.close();
+		mc_tree->init(node_state);
+		PlayoutState* root = mc_tree->root_state;
+		UtilityScores& u = *mc_tree->root_u;
+		for (policyid = 0; policyid < 7; policyid++) {
+			policy_timer.restart();
+			for (i = 0; i < BENCHPOLICY_CALLS; i++) {
+				tankid = i & 3;
+				cmds.clear();
+				switch (policyid) {
+				default:
+				case 0:
+					sink += root->bestC(tankid,u.simplecost[tankid/2],cmds);
+					break;
+				case 1:
+					sink += root->greedyC(tankid,u);
+					break;
+				case 2:
+					sink += root->bestCExpensive(tankid,u.expensivecost[tankid],mc_tree->root_obstacles[tankid],u.footprint[U_EXPENSIVE(tankid)],cmds);
+					break;
+				case 3:
+					sink += root->bestOCMD(root->tank[tankid].x,root->tank[tankid].y,u.simplecost[tankid/2],cmds);
+					break;
+				case 4:
+					sink += root->bestOCMD(root->tank[tankid].x,root->tank[tankid].y,u.expensivecost[tankid],mc_tree->root_obstacles[tankid],cmds);
+					break;
+				case 5:
+					sink += root->bestOCMDDodgeCanfire(tankid,mc_tree->root_obstacles[tankid],cmds);
+					break;
+				case 6:
+					sink += root->bestOCMDDodgeCantfire(tankid,mc_tree->root_obstacles[tankid],cmds);
+					break;
+				}
+			}
+			policy_timer.stop();
+			cout << setw(24) << policy_name[policyid] << ": "
+					<< (double)policy_timer.get_microseconds()*1000.0/BENCHPOLICY_CALLS << " ns/call" << endl;
+		}
+		cout << "(checksum " << sink << ")" << endl;
+		delete node_state;
+		delete mc_tree;
+	} else if (mode == MODE_VERIFYREPAIR) {
+		//Play a game, keeping one set of cost matrices up to date by repairing
+		//them and another by refilling them every tick.
+		//They'd better agree, footprints and all.
+		PlayoutState* node_state = new PlayoutState;
+		UtilityScores* repaired = new UtilityScores;
+		UtilityScores* refilled = new UtilityScores;
+		obstacles_t* repaired_obstacles = new obstacles_t[1];
+		obstacles_t* refilled_obstacles = new obstacles_t[1];
+		platformstl::performance_counter repair_timer;
+		platformstl::performance_counter refill_timer;
+		StatCounter repair_stat;
+		StatCounter refill_stat;
+		sfmt_t sfmt;
+		scored_cmds_t cmds;
+		int tick,tankid,job,x,y,o,mismatches = 0;
+		ifstream fin("board1.map");
+		fin >> *node_state;
+		node_state->endgame_tick = 200;
+		node_state->gameover = false;
+		node_state->stop_playout = false;
+		fin.close();
+		node_state->drawBases();
+		node_state->drawTanks();
+		node_state->drawBullets();
+		repair_stat.init();
+		refill_stat.init();
+		sfmt_init_gen_rand(&sfmt,(uint32_t)VERIFYREPAIR_TICKS);
+		refilled->incremental = false;
+		for (tick = 0; tick < VERIFYREPAIR_TICKS && !node_state->gameover; tick++) {
+			node_state->updateCanFire();
+			repair_timer.restart();
+			node_state->updateSimpleUtilityScores(*repaired);
+			node_state->updateExpensiveUtilityScores(*repaired,*repaired_obstacles);
+			repair_timer.stop();
+			refill_timer.restart();
+			node_state->updateSimpleUtilityScores(*refilled);
+			node_state->updateExpensiveUtilityScores(*refilled,*refilled_obstacles);
+			refill_timer.stop();
+			repair_stat.push((double)repair_timer.get_microseconds()/1000.0);
+			refill_stat.push((double)refill_timer.get_microseconds()/1000.0);
+			for (x = 0; x < node_state->max_x; x++) {
+				for (y = 0; y < node_state->max_y; y++) {
+					for (o = 0; o < 4; o++) {
+						mismatches += (repaired->simplecost[0](x,y,o) != refilled->simplecost[0](x,y,o));
+						mismatches += (repaired->simplecost[1](x,y,o) != refilled->simplecost[1](x,y,o));
+						for (tankid = 0; tankid < 4; tankid++) {
+							mismatches += (repaired->expensivecost[tankid](x,y,o) != refilled->expensivecost[tankid](x,y,o));
+						}
+					}
+					for (job = 0; job < U_JOBS; job++) {
+						mismatches += (repaired->footprint[job][x][y] != refilled->footprint[job][x][y]);
+					}
+				}
+			}
+			//Mostly sensible moves, with enough noise to keep things changing
+			for (tankid = 0; tankid < 4; tankid++) {
+				if (sfmt_genrand_uint32(&sfmt) % 4 == 0) {
+					node_state->command[tankid] = sfmt_genrand_uint32(&sfmt) % 6;
+				} else {
+					cmds.clear();
+					node_state->command[tankid] = node_state->bestCExpensive(tankid,refilled->expensivecost[tankid],(*refilled_obstacles)[tankid],refilled->footprint[U_EXPENSIVE(tankid)],cmds);
+				}
+			}
+			node_state->simulateTick();
+		}
+		cout << "Ticks: " << tick << " mismatches: " << mismatches << endl;
+		cout << "Repair mean: " << repair_stat.mean() << " ms" << endl;
+		cout << "Refill mean: " << refill_stat.mean() << " ms" << endl;
+		delete[] repaired_obstacles;
+		delete[] refilled_obstacles;
+		delete refilled;
+		delete repaired;
+		delete node_state;
+	} else if (mode == MODE_BENCHRNG) {
+		//How much of a playout goes to random numbers: count the draws playouts
+		//make, then time the same kinds of draw reduced with % and without.
+		MCTree* mc_tree = new MCTree;
+		PlayoutState* node_state = new PlayoutState;
+		PlayoutState* tmp_state = new PlayoutState;
+		sfmt_t* sfmt = mc_tree->worker_sfmt[0];
+		sfmt_t counter;
+		platformstl::performance_counter rng_timer;
+		double playout_us,modulo_ns,shift_ns;
+		long int i,draws = 0;
+		uint32_t sink = 0;
+		ifstream fin("board1.map");
+		fin >> *node_state;
+		node_state->endgame_tick = 200;
+		node_state->gameover = false;
+		node_state->stop_playout = false;
+		fin.close();
+		mc_tree->init(node_state);
+
+		memcpy(&counter,sfmt,sizeof(sfmt_t));
+		rng_timer.restart();
+		for (i = 0; i < BENCHRNG_PLAYOUTS; i++) {
+			*tmp_state = *mc_tree->root_state;
+			tmp_state->playout(sfmt,*mc_tree->root_u,mc_tree->playout_depth,mc_tree->policy_at(0));
+		}
+		rng_timer.stop();
+		playout_us = (double)rng_timer.get_microseconds()/BENCHRNG_PLAYOUTS;
+		//Catch a copy of the stream up with it
+		while (counter.idx != sfmt->idx || memcmp(counter.state,sfmt->state,sizeof(counter.state)) != 0) {
+			sfmt_genrand_uint32(&counter);
+			draws++;
+		}
+
+		rng_timer.restart();
+		for (i = 0; i < BENCHRNG_DRAWS; i += 3) {
+			sink += (sfmt_genrand_uint32(sfmt) % 100 < (EPSILON_GREEDY-1));
+			sink += sfmt_genrand_uint32(sfmt) % 6;
+			sink += (sfmt_genrand_uint32(sfmt) % 10 == 0);
+		}
+		rng_timer.stop();
+		modulo_ns = (double)rng_timer.get_microseconds()*1000.0/BENCHRNG_DRAWS;
+		rng_timer.restart();
+		for (i = 0; i < BENCHRNG_DRAWS; i += 3) {
+			sink += randomChance(sfmt,RANDOM_CHANCE(EPSILON_GREEDY-1,100));
+			sink += randomBelow(sfmt,6);
+			sink += randomChance(sfmt,RANDOM_CHANCE(1,10));
+		}
+		rng_timer.stop();
+		shift_ns = (double)rng_timer.get_microseconds()*1000.0/BENCHRNG_DRAWS;
+
+		cout << "Playout: " << playout_us << " us, " << (double)draws/BENCHRNG_PLAYOUTS << " draws" << endl;
+		cout << "         %: " << modulo_ns << " ns/draw, "
+				<< modulo_ns*draws/BENCHRNG_PLAYOUTS/(playout_us*10.0) << "% of a playout" << endl;
+		cout << "     shift: " << shift_ns << " ns/draw, "
+				<< shift_ns*draws/BENCHRNG_PLAYOUTS/(playout_us*10.0) << "% of a playout" << endl;
+		cout << "(checksum " << sink << ")" << endl;
+		delete tmp_state;
+		delete node_state;
+		delete mc_tree;
+	} else if (mode == MODE_BENCHDEPTH) {
+		//Truncated playouts against full ones: how many go by per second, and
+		//whether they pick the same move for player 0 as full playouts do. The
+		//second row is full playouts again, to show how noisy picking is anyway.
+		MCTree* mc_tree = new MCTree;
+		PlayoutState* game_state = new PlayoutState;
+		PlayoutState* tmp_state = new PlayoutState;
+		sfmt_t* sfmt = mc_tree->worker_sfmt[0];
+		platformstl::performance_counter depth_timer;
+		const int depth[BENCHDEPTH_DEPTHS] = {0,0,10,20,40,80};
+		double value[BENCHDEPTH_DEPTHS][36];
+		double seconds[BENCHDEPTH_DEPTHS];
+		double regret[BENCHDEPTH_DEPTHS];
+		int agree[BENCHDEPTH_DEPTHS];
+		int best[BENCHDEPTH_DEPTHS];
+		int i,d,st,tick,tankid;
+		Move m;
+		ifstream fin("board1.map");
+		fin >> *game_state;
+		game_state->endgame_tick = 200;
+		game_state->gameover = false;
+		game_state->stop_playout = false;
+		fin.close();
+		for (d = 0; d < BENCHDEPTH_DEPTHS; d++) {
+			seconds[d] = 0;
+			regret[d] = 0;
+			agree[d] = 0;
+		}
+		for (st = 0; st < BENCHDEPTH_STATES; st++) {
+			mc_tree->init(game_state);
+			for (d = 0; d < BENCHDEPTH_DEPTHS; d++) {
+				depth_timer.restart();
+				for (m.alpha = 0; m.alpha < 36; m.alpha++) {
+					value[d][m.alpha] = 0;
+					for (i = 0; i < BENCHDEPTH_PLAYOUTS; i++) {
+						*tmp_state = *mc_tree->root_state;
+						m.beta = randomBelow(sfmt,36);
+						tmp_state->move(m);
+						value[d][m.alpha] += tmp_state->playout(sfmt,*mc_tree->root_u,depth[d],mc_tree->policy_at(0));
+					}
+					value[d][m.alpha] /= BENCHDEPTH_PLAYOUTS;
+				}
+				depth_timer.stop();
+				seconds[d] += (double)depth_timer.get_microseconds()/1000000.0;
+				best[d] = max_element(value[d],value[d]+36)-value[d];
+				agree[d] += (best[d] == best[0]);
+				regret[d] += value[0][best[0]]-value[0][best[d]];
+			}
+			//Move the game along a bit for the next state
+			*game_state = *mc_tree->root_state;
+			for (tick = 0; tick < 8 && !game_state->gameover; tick++) {
+				for (tankid = 0; tankid < 4; tankid++) {
+					game_state->command[tankid] = game_state->randomC(tankid,sfmt);
+				}
+				game_state->simulateTick();
+			}
+			if (game_state->gameover) {
+				break;
+			}
+		}
+		cout << "States: " << min(st+1,BENCHDEPTH_STATES) << endl;
+		for (d = 0; d < BENCHDEPTH_DEPTHS; d++) {
+			cout << setw(6);
+			if (depth[d] == 0) {
+				cout << "full";
+			} else {
+				cout << depth[d];
+			}
+			cout << ": " << setw(8) << (int)(36.0*BENCHDEPTH_PLAYOUTS*min(st+1,BENCHDEPTH_STATES)/seconds[d]) << " playouts/s, "
+					<< "same move " << agree[d] << "/" << min(st+1,BENCHDEPTH_STATES)
+					<< ", regret " << regret[d]/min(st+1,BENCHDEPTH_STATES) << endl;
+		}
+		delete tmp_state;
+		delete game_state;
+		delete mc_tree;
+	} else if (mode == MODE_BENCHPLAYOUT) {
+		//Each playout policy's instantiation, from board1's opening position
+		MCTree* mc_tree = new MCTree;
+		PlayoutState* node_state = new PlayoutState;
+		PlayoutState* tmp_state = new PlayoutState;
+		platformstl::performance_counter playout_timer;
+		const char* policy_name[] = {"random","greedy (table)","greedy"};
+		double result;
+		long int ticks;
+		int i,policy;
+		ifstream fin("board1.map");
+		fin >> *node_state;
+		node_state->endgame_tick = 200;
+		node_state->gameover = false;
+		node_state->stop_playout = false;
+		fin.close();
+		mc_tree->init(node_state);
+		for (policy = PLAYOUT_RANDOM; policy <= PLAYOUT_GREEDY; policy++) {
+			result = 0;
+			ticks = 0;
+			playout_timer.restart();
+			for (i = 0; i < BENCHPLAYOUT_PLAYOUTS; i++) {
+				*tmp_state = *mc_tree->root_state;
+				result += tmp_state->playout(mc_tree->worker_sfmt[0],*mc_tree->root_u,mc_tree->playout_depth,policy);
+				ticks += tmp_state->tickno-mc_tree->root_state->tickno;
+			}
+			playout_timer.stop();
+			cout << setw(16) << policy_name[policy] << ": "
+					<< (double)playout_timer.get_microseconds()/BENCHPLAYOUT_PLAYOUTS << " us/playout, "
+					<< (double)ticks/BENCHPLAYOUT_PLAYOUTS << " ticks, mean result "
+					<< result/BENCHPLAYOUT_PLAYOUTS << endl;
+		}
+		delete tmp_state;
+		delete node_state;
+		delete mc_tree;
+	} else if (mode == MODE_BENCHSCALE) {
+		//board1 tiled out to bigger maps, bases and tanks moved to scale
+		const int sizes[] = {81,128,256,512,1024};
+		PlayoutState* map_state = new PlayoutState;
+		PlayoutState* node_state = new PlayoutState;
+		PlayoutState* tmp_state = new PlayoutState;
+		UtilityScores* utility = new UtilityScores;
+		obstacles_t* obstacles = new obstacles_t[1];
+		platformstl::performance_counter timer;
+		sfmt_t sfmt;
+		double refill_ms;
+		long int ticks;
+		size_t state_bytes;
+		int i,n,x;
+		ifstream fin("board1.map");
+		fin >> *map_state;
+		fin.close();
+		sfmt_init_gen_rand(&sfmt,(uint32_t)BENCHSCALE_PLAYOUTS);
+		for (i = 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); i++) {
+			n = sizes[i];
+			tileMap(*map_state,*node_state,n);
+			node_state->endgame_tick = node_state->tickno+200;
+			node_state->gameover = false;
+			node_state->stop_playout = false;
+			node_state->updateCanFire();
+			//Full fills only, hierarchical ones are what verifyhpa is for
+			utility->resize(n,n);
+			utility->hierarchical = false;
+			utility->incremental = false;
+			timer.restart();
+			for (x = 0; x < BENCHSCALE_FILLS; x++) {
+				node_state->updateSimpleUtilityScores(*utility);
+				node_state->updateExpensiveUtilityScores(*utility,*obstacles);
+			}
+			timer.stop();
+			refill_ms = (double)timer.get_microseconds()/1000.0/BENCHSCALE_FILLS;
+			node_state->updateSimpleUtilityScores(*utility);
+			ticks = 0;
+			timer.restart();
+			for (x = 0; x < BENCHSCALE_PLAYOUTS; x++) {
+				*tmp_state = *node_state;
+				tmp_state->playout(&sfmt,*utility,0,PLAYOUT_GREEDYTABLE);
+				ticks += tmp_state->tickno-node_state->tickno;
+			}
+			timer.stop();
+			state_bytes = node_state->board.bytes()+node_state->occupant.bytes()
+					+node_state->wallbits[O_X].bytes()+node_state->wallbits[O_Y].bytes();
+			cout << setw(4) << n << "x" << setw(4) << left << n << right << ": "
+					<< state_bytes/1024 << " KB state, "
+					<< utility->bytes()/1024 << " KB utility ("
+					<< pathStates(n,n) << " path states), refill "
+					<< refill_ms << " ms, "
+					<< (double)timer.get_microseconds()*1000.0/max(ticks,1L) << " ns/tick" << endl;
+		}
+		delete[] obstacles;
+		delete utility;
+		delete tmp_state;
+		delete node_state;
+		delete map_state;
+	} else if (mode == MODE_VERIFYHPA) {
+		//Play a game on a big map, filling expensivecost in full (repairing as
+		//usual) and hierarchically. Near the tanks, the hierarchical costs can
+		//only be dearer, and not by much.
+		PlayoutState* map_state = new PlayoutState;
+		PlayoutState* node_state = new PlayoutState;
+		UtilityScores* exact = new UtilityScores;
+		UtilityScores* hierarchical = new UtilityScores;
+		obstacles_t* exact_obstacles = new obstacles_t[1];
+		obstacles_t* hierarchical_obstacles = new obstacles_t[1];
+		platformstl::performance_counter exact_timer;
+		platformstl::performance_counter hierarchical_timer;
+		StatCounter exact_stat;
+		StatCounter hierarchical_stat;
+		sfmt_t sfmt;
+		scored_cmds_t cmds;
+		int tick,tankid,x,y,o,a,b,n,first = 0,same = 0,cheaper = 0,queries = 0,agree = 0,commands = 0;
+		double excess = 0,cost = 0;
+		ifstream fin("board1.map");
+		fin >> *map_state;
+		fin.close();
+		n = (argc > 2) ? atoi(argv[2]) : VERIFYHPA_SIZE;
+		tileMap(*map_state,*node_state,n);
+		node_state->endgame_tick = node_state->tickno+VERIFYHPA_TICKS/2;
+		node_state->gameover = false;
+		node_state->stop_playout = false;
+		exact->resize(n,n);
+		exact->hierarchical = false;
+		hierarchical->resize(n,n);
+		hierarchical->hierarchical = true;
+		exact_stat.init();
+		hierarchical_stat.init();
+		sfmt_init_gen_rand(&sfmt,(uint32_t)VERIFYHPA_TICKS);
+		for (tick = 0; tick < VERIFYHPA_TICKS && !node_state->gameover; tick++) {
+			node_state->updateCanFire();
+			exact_timer.restart();
+			node_state->updateExpensiveUtilityScores(*exact,*exact_obstacles);
+			exact_timer.stop();
+			hierarchical_timer.restart();
+			node_state->updateExpensiveUtilityScores(*hierarchical,*hierarchical_obstacles);
+			hierarchical_timer.stop();
+			//The first fill builds everything
+			if (tick == 0) {
+				first = (int)(hierarchical_timer.get_microseconds()/1000);
+			} else {
+				exact_stat.push((double)exact_timer.get_microseconds()/1000.0);
+				hierarchical_stat.push((double)hierarchical_timer.get_microseconds()/1000.0);
+			}
+			for (tankid = 0; tankid < 4; tankid++) {
+				if (!node_state->tank[tankid].active) {
+					continue;
+				}
+				//What bestCExpensive looks at
+				for (x = node_state->tank[tankid].x-1; x <= node_state->tank[tankid].x+1; x++) {
+					for (y = node_state->tank[tankid].y-1; y <= node_state->tank[tankid].y+1; y++) {
+						for (o = 0; o < 4; o++) {
+							a = exact->expensivecost[tankid](x,y,o);
+							b = hierarchical->expensivecost[tankid](x,y,o);
+							queries++;
+							same += (a == b);
+							cheaper += (b < a);
+							if (a != INT_MAX && b != INT_MAX) {
+								excess += b-a;
+								cost += a;
+							}
+						}
+					}
+				}
+			}
+			for (tankid = 0; tankid < 4; tankid++) {
+				if (!node_state->tank[tankid].active) {
+					continue;
+				}
+				cmds.clear();
+				a = node_state->bestCExpensive(tankid,exact->expensivecost[tankid],(*exact_obstacles)[tankid],exact->footprint[U_EXPENSIVE(tankid)],cmds);
+				cmds.clear();
+				b = node_state->bestCExpensive(tankid,hierarchical->expensivecost[tankid],(*hierarchical_obstacles)[tankid],hierarchical->footprint[U_EXPENSIVE(tankid)],cmds);
+				commands++;
+				agree += (a == b);
+				//Mostly sensible moves, with enough noise to keep things changing
+				if (sfmt_genrand_uint32(&sfmt) % 4 == 0) {
+					node_state->command[tankid] = sfmt_genrand_uint32(&sfmt) % 6;
+				} else {
+					node_state->command[tankid] = a;
+				}
+			}
+			node_state->simulateTick();
+		}
+		cout << n << "x" << n << ", " << tick << " ticks" << endl;
+		cout << "Exact mean: " << exact_stat.mean() << " ms" << endl;
+		cout << "Hierarchical mean: " << hierarchical_stat.mean() << " ms (first fill " << first << " ms)" << endl;
+		cout << "Costs near the tanks: " << same << "/" << queries << " the same, " << cheaper << " cheaper, "
+				<< 100.0*excess/max(cost,1.0) << "% dearer on the whole" << endl;
+		cout << "Same command: " << agree << "/" << commands << endl;
+		delete[] exact_obstacles;
+		delete[] hierarchical_obstacles;
+		delete hierarchical;
+		delete exact;
+		delete node_state;
+		delete map_state;
+	} else if (mode == MODE_BENCHSOAP) {
+		//Needs a running server; getStatus only reads, so a game can be on
+		NetworkCore* netcore = new NetworkCore(soap_endpoint);
+		cout << "Benchmarking getStatus on [" << soap_endpoint << "]" << endl;
+		netcore->benchStatus((argc > 3) ? atoi(argv[3]) : BENCHSOAP_CALLS);
+		delete netcore;
+	} else if (mode == MODE_BENCHDECODE) {
+		//Offline, the responses are read off s.soap->is
+		NetworkCore* netcore = new NetworkCore(soap_endpoint);
+		netcore->benchDecode((argc > 2) ? argv[2] : NULL, (argc > 3) ? argv[3] : NULL, BENCHDECODE_ROUNDS);
+		delete netcore;
+	} else if (mode == MODE_SERVE) {
+		//Stands in for the contest server on board1.map: point one client at
+		//port and another at port+1, or a single one at port
+		ChallengeServer* server = new ChallengeServer("board1.map", (argc > 2) ? atoi(argv[2]) : SERVE_PORT);
+		if (argc > 3) {
+			server->tick_ms = atoi(argv[3]);
+		}
+		if (argc > 4) {
+			server->delay_ms = atoi(argv[4]);
+		}
+		if (argc > 5) {
+			server->jitter_ms = atoi(argv[5]);
+		}
+		if (argc > 6) {
+			server->max_ticks = atoi(argv[6]);
+		}
+		server->run();
+		delete server;
 	}
 
 
@@ -16,6 +16,9 @@
 #include <utility>
 #include <algorithm>
 #include <functional>
+#ifdef WIN32
+#include <intrin.h>
+#endif
 
 using namespace std;
 
@@ -33,6 +36,21 @@ struct Move {
 //15% of moves in the random playout uses the greedy algorithm
 #define EPSILON_GREEDY 15
 
+//Playouts stop after this many ticks and return PlayoutState::evaluate, 0 plays them out
+#define PLAYOUT_DEPTH 0
+
+//Playout policies: how PlayoutState::playout picks each tick's commands
+#define PLAYOUT_RANDOM 0 //randomC only
+#define PLAYOUT_GREEDYTABLE 1 //EPSILON_GREEDY% greedyC off the greedycmd table
+#define PLAYOUT_GREEDY 2 //EPSILON_GREEDY% bestC, worked out in full
+//MCTree uses PLAYOUT_SHALLOW for playouts starting less than PLAYOUT_DEEP_FROM
+//plies below the root, PLAYOUT_DEEP for the rest
+#define PLAYOUT_SHALLOW PLAYOUT_GREEDYTABLE
+#define PLAYOUT_DEEP PLAYOUT_GREEDYTABLE
+#define PLAYOUT_DEEP_FROM 2
+//What being nearer the enemy base than the enemy is to yours is worth to evaluate
+#define EVAL_DISTANCE_WEIGHT 0.2
+
 //A terminal score should dominate the normal scores
 #define TERMINAL_BONUS 36.0
 
@@ -75,6 +93,12 @@ typedef uint16_t move_t;
 #define C_ISMOVE(c) ((c) > 1)
 #define C_TO_O(c) ((c) - 2)
 
+// A greedy table entry holds two commands: the low nibble if the tank can fire,
+// the high nibble if it can't.
+#define G_PACK(canfire,cantfire) (((cantfire) << 4) | (canfire))
+#define G_CANFIRE(g) ((g) & 0x0f)
+#define G_CANTFIRE(g) ((g) >> 4)
+
 const int BUMP_LOOKUP_TABLE[4][5][2] = {
 		{{-2,-3},{-1,-3},{ 0,-3},{ 1,-3},{ 2,-3}},/*up*/
 		{{-2, 3},{-1, 3},{ 0, 3},{ 1, 3},{ 2, 3}},/*down*/
@@ -113,8 +137,6 @@ const int FIRE_LOOKUP_TABLE[4][2] = {
 
 #define NUMMOVES 36 //Number of possible moves
 
-#define MAX_BATTLEFIELD_DIM 128 // 128x128 battlefield
-
 #define B_X 0
 #define B_Y 1
 
@@ -182,6 +204,29 @@ const int AVOIDANCE_CANTFIRE_MATRIX[5][5] = {
 	{1,2,3,1,2}
 };
 
+// Position of the lowest/highest set bit, w must not be 0
+#ifdef WIN32
+inline int lowestBit(uint32_t w) {
+	unsigned long i;
+	_BitScanForward(&i,w);
+	return (int)i;
+}
+
+inline int highestBit(uint32_t w) {
+	unsigned long i;
+	_BitScanReverse(&i,w);
+	return (int)i;
+}
+#else
+inline int lowestBit(uint32_t w) {
+	return __builtin_ctz(w);
+}
+
+inline int highestBit(uint32_t w) {
+	return 31-__builtin_clz(w);
+}
+#endif
+
 inline const char* o2str(int o) {
 	switch (o) {
 	default: